@@ -0,0 +1,111 @@
+#!/usr/bin/env bash
+# bench/run.sh
+# Regression benchmark: starts the server in each engine mode, drives it with
+# the client load generator through the standard scenarios and writes the
+# results as a JSON array and a CSV table, one row per (mode, scenario),
+# tagged with the git version so runs of different versions can be diffed.
+#
+#   make bench
+#   BENCH_DURATION=10 BENCH_MODES="epoll uring" make bench
+#
+# Scenarios:
+#   small  64-byte keep-alive RPS on 4 threads x 8 connections
+#   bulk   1 MB messages on 2 keep-alive connections
+#   idle   10000 idle connections plus 100 active ones (epoll engine client);
+#          event-loop modes only, a blocking server would need a thread or a
+#          worker per idle connection
+#   churn  a new connection for every 64-byte message
+#
+# Environment: BENCH_DURATION (seconds per scenario, default 5), BENCH_MODES
+# (default "thread pool epoll uring"; uring falls back to epoll when the
+# server was built without it, recorded in the "engine" column), BENCH_SCENARIOS,
+# BENCH_PORT (default 5599), BENCH_OUT (default bench/results).
+
+set -u
+cd "$(dirname "$0")/.."
+
+duration=${BENCH_DURATION:-5}
+modes=${BENCH_MODES:-"thread pool epoll uring"}
+scenarios=${BENCH_SCENARIOS:-"small bulk idle churn"}
+port=${BENCH_PORT:-5599}
+out=${BENCH_OUT:-bench/results}
+version=$(git describe --always --dirty 2>/dev/null || echo unknown)
+
+scenario_args() {
+  case "$1" in
+    small) echo "4 --conns=8 --keepalive --size=64" ;;
+    bulk) echo "2 --keepalive --size=1048576" ;;
+    idle) echo "2 --engine=epoll --conns=50 --keepalive --size=64 --idle=10000" ;;
+    churn) echo "4 --size=64" ;;
+    *) return 1 ;;
+  esac
+}
+
+# Starts the server and waits for its "listening" line; sets server_pid.
+start_server() {
+  local mode=$1 log=$2
+  ./server "$port" --mode="$mode" --stats-interval=0 2>"$log" &
+  server_pid=$!
+  for _ in $(seq 50); do
+    grep -q "listening on" "$log" && return 0
+    kill -0 "$server_pid" 2>/dev/null || break
+    sleep 0.1
+  done
+  echo "bench: server --mode=$mode did not start:" >&2
+  cat "$log" >&2
+  return 1
+}
+
+stop_server() {
+  kill "$server_pid" 2>/dev/null
+  wait "$server_pid" 2>/dev/null
+}
+
+[ -x ./server ] && [ -x ./client ] || { echo "bench: build with make first" >&2; exit 1; }
+ulimit -n "$(ulimit -Hn)" 2>/dev/null # 10k idle connections on both ends
+mkdir -p "$out"
+json="$out/results.json"
+csv="$out/results.csv"
+log=$(mktemp)
+trap 'rm -f "$log"; [ -n "${server_pid:-}" ] && stop_server' EXIT
+
+echo "[" >"$json"
+first=1
+csv_header=1
+: >"$csv"
+
+for mode in $modes; do
+  for sc in $scenarios; do
+    args=$(scenario_args "$sc") || { echo "bench: unknown scenario $sc" >&2; exit 1; }
+    if [ "$sc" = idle ] && { [ "$mode" = thread ] || [ "$mode" = pool ]; }; then
+      echo "bench: skipping $sc on --mode=$mode"
+      continue
+    fi
+
+    start_server "$mode" "$log" || exit 1
+    engine=$mode
+    grep -q "built without io_uring" "$log" && engine=epoll
+
+    # shellcheck disable=SC2086 # args is a list of words
+    row=$(./client --bench "$port" $args --duration="$duration" --json)
+    stop_server
+    server_pid=
+
+    tag="\"version\": \"$version\", \"mode\": \"$mode\", \"server_engine\": \"$engine\", \"scenario\": \"$sc\", "
+    [ $first -eq 1 ] || echo "," >>"$json"
+    first=0
+    printf '  %s' "{$tag${row#\{}" >>"$json"
+
+    # The client's record is flat, so its keys and values map straight to CSV.
+    if [ $csv_header -eq 1 ]; then
+      echo "version,mode,server_engine,scenario,$(echo "$row" | sed 's/"\([a-z0-9_]*\)": [^,}]*/\1/g; s/[{} ]//g')" >>"$csv"
+      csv_header=0
+    fi
+    echo "$version,$mode,$engine,$sc,$(echo "$row" | sed 's/"[a-z0-9_]*": //g; s/[{}" ]//g')" >>"$csv"
+
+    echo "$mode/$sc: $(echo "$row" | sed 's/.*"msgs_per_s": \([0-9.]*\).*"mb_per_s": \([0-9.]*\).*"p99_us": \([0-9.]*\).*/\1 msgs\/s, \2 MB\/s, p99 \3 us/')"
+  done
+done
+
+printf '\n]\n' >>"$json"
+echo "bench: wrote $json and $csv"
@@ -0,0 +1,103 @@
+// bench/upper_bench.c
+// Microbenchmark: every to_uppercase kernel vs. the original per-byte toupper() loop.
+// Usage: ./bench/upper_bench [min_ms_per_case]
+// Prints GB/s per kernel and payload size; the buffer refill is not counted.
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../transform.h"
+
+static double now_sec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Mixed-case text with some punctuation and high-bit bytes.
+static void fill(unsigned char *buf, size_t n, unsigned seed) {
+  for (size_t i = 0; i < n; i++) {
+    seed = seed * 1103515245u + 12345u;
+    unsigned r = (seed >> 16) & 0xff;
+    buf[i] = (unsigned char)(r < 200 ? 'A' + (r % 58) : r);
+  }
+}
+
+// Input for one timed sweep: refilled between sweeps and small enough to
+// stay in L2, so every kernel call gets fresh mixed-case bytes.
+#define POOL_BYTES (256 * 1024)
+
+// Nanoseconds per kernel call on n bytes. Each sweep runs the kernel over a
+// pool of n-byte slots copied from src beforehand; only the kernel calls are
+// inside the clock, and a sweep is long enough even for 16-byte payloads.
+static double time_kernel(upper_fn_t fn, unsigned char *pool, const unsigned char *src,
+                          size_t n, double min_sec) {
+  size_t slots = n < POOL_BYTES ? POOL_BYTES / n : 1;
+  size_t calls = 0;
+  double spent = 0;
+  while (spent < min_sec) {
+    memcpy(pool, src, slots * n);
+    double t0 = now_sec();
+    for (size_t i = 0; i < slots; i++) fn(pool + i * n, n);
+    __asm__ __volatile__("" : : "r"(pool) : "memory");
+    spent += now_sec() - t0;
+    calls += slots;
+  }
+  return spent * 1e9 / (double)calls;
+}
+
+int main(int argc, char **argv) {
+  double min_sec = (argc >= 2 ? atof(argv[1]) : 200.0) / 1000.0;
+  const size_t sizes[] = {16, 64, 512, 1500, 4096, 65536, 1 << 20};
+  const size_t max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+
+  unsigned char *src = (unsigned char *)malloc(max_size);
+  unsigned char *ref = (unsigned char *)malloc(max_size);
+  unsigned char *buf = (unsigned char *)malloc(max_size > POOL_BYTES ? max_size : POOL_BYTES);
+  if (!src || !ref || !buf) {
+    perror("malloc");
+    return 1;
+  }
+  fill(src, max_size, 42);
+
+  const upper_kernel_t *kernels = upper_kernels();
+
+  // Check every kernel against the toupper() baseline on odd lengths and offsets.
+  for (const upper_kernel_t *k = kernels; k->name; k++) {
+    if (!k->supported) continue;
+    for (size_t off = 0; off < 33; off++) {
+      size_t n = 4096 - off * 3;
+      memcpy(ref, src + off, n);
+      memcpy(buf, src + off, n);
+      kernels[0].fn(ref, n);
+      k->fn(buf, n);
+      if (memcmp(ref, buf, n) != 0) {
+        fprintf(stderr, "kernel %s mismatches toupper() at offset %zu\n", k->name, off);
+        return 1;
+      }
+    }
+  }
+
+  printf("%-8s", "bytes");
+  for (const upper_kernel_t *k = kernels; k->name; k++) {
+    if (k->supported) printf(" %12s", k->name);
+  }
+  printf("   (GB/s)\n");
+
+  for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    size_t n = sizes[s];
+    printf("%-8zu", n);
+    for (const upper_kernel_t *k = kernels; k->name; k++) {
+      if (k->supported) printf(" %12.2f", (double)n / time_kernel(k->fn, buf, src, n, min_sec));
+    }
+    printf("\n");
+  }
+
+  free(src);
+  free(ref);
+  free(buf);
+  return 0;
+}
@@ -1,169 +1,1309 @@
-// client.c
-// Multi-threaded TCP client simulator: creates at least 5 threads.
-// Each thread connects to 127.0.0.1, sends a string, receives processed response, prints it.
-// Handles partial sends/receives with loops.
-
-#define _POSIX_C_SOURCE 200809L
-#include <arpa/inet.h>
-#include <errno.h>
-#include <pthread.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <sys/socket.h>
-#include <unistd.h>
-
-#define BUF_SIZE 4096
-#define DEFAULT_PORT 5555
-#define DEFAULT_THREADS 5
-
-typedef struct {
-  int id;
-  int port;
-  const char *msg;
-} worker_args_t;
-
-static void die(const char *msg) {
-  perror(msg);
-  exit(EXIT_FAILURE);
-}
-
-static ssize_t send_all(int fd, const void *buf, size_t len) {
-  const unsigned char *p = (const unsigned char *)buf;
-  size_t total = 0;
-
-  while (total < len) {
-    ssize_t n = send(fd, p + total, len - total, 0);
-    if (n < 0) {
-      if (errno == EINTR) continue;
-      return -1;
-    }
-    if (n == 0) break;
-    total += (size_t)n;
-  }
-  return (ssize_t)total;
-}
-
-// Receive exactly len bytes (advanced-style).
-// For echo: we expect server returns same length as sent.
-// If server closes early, return bytes received so far.
-static ssize_t recv_exact(int fd, void *buf, size_t len) {
-  unsigned char *p = (unsigned char *)buf;
-  size_t total = 0;
-
-  while (total < len) {
-    ssize_t n = recv(fd, p + total, len - total, 0);
-    if (n < 0) {
-      if (errno == EINTR) continue;
-      return -1;
-    }
-    if (n == 0) break; // server closed
-    total += (size_t)n;
-  }
-  return (ssize_t)total;
-}
-
-static void *worker(void *arg) {
-  worker_args_t *a = (worker_args_t *)arg;
-
-  // 1) socket
-  int fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (fd < 0) {
-    perror("[client] socket");
-    return NULL;
-  }
-
-  // 2) connect to 127.0.0.1:port
-  struct sockaddr_in srv;
-  memset(&srv, 0, sizeof(srv));
-  srv.sin_family = AF_INET;
-  srv.sin_port = htons((uint16_t)a->port);
-  srv.sin_addr.s_addr = inet_addr("127.0.0.1");
-
-  if (connect(fd, (struct sockaddr *)&srv, sizeof(srv)) < 0) {
-    perror("[client] connect");
-    close(fd);
-    return NULL;
-  }
-
-  // 3) send message
-  size_t len = strlen(a->msg);
-  if (len == 0) {
-    close(fd);
-    return NULL;
-  }
-  if (len > BUF_SIZE) len = BUF_SIZE; // keep it safe
-
-  if (send_all(fd, a->msg, len) < 0) {
-    perror("[client] send");
-    close(fd);
-    return NULL;
-  }
-
-  // 4) recv response (same length)
-  char resp[BUF_SIZE + 1];
-  memset(resp, 0, sizeof(resp));
-
-  ssize_t r = recv_exact(fd, resp, len);
-  if (r < 0) {
-    perror("[client] recv");
-    close(fd);
-    return NULL;
-  }
-  resp[r] = '\0';
-
-  // 5) print
-  printf("[client thread %d] sent: \"%.*s\" | got: \"%s\"\n",
-         a->id, (int)len, a->msg, resp);
-
-  // 6) close socket
-  close(fd);
-  return NULL;
-}
-
-int main(int argc, char **argv) {
-  int port = DEFAULT_PORT;
-  int threads = DEFAULT_THREADS;
-
-  if (argc >= 2) port = atoi(argv[1]);
-  if (argc >= 3) threads = atoi(argv[2]);
-
-  if (port <= 0 || port > 65535 || threads < 5) {
-    fprintf(stderr, "Usage: %s [port] [threads>=5]\n", argv[0]);
-    return 1;
-  }
-
-  const char *messages[] = {
-      "hello from thread!",
-      "system programming is fun",
-      "abcXYZ 123",
-      "Shenkar test",
-      "lowercase -> uppercase"
-  };
-  int msg_count = (int)(sizeof(messages) / sizeof(messages[0]));
-
-  pthread_t *tids = (pthread_t *)calloc((size_t)threads, sizeof(pthread_t));
-  worker_args_t *args = (worker_args_t *)calloc((size_t)threads, sizeof(worker_args_t));
-  if (!tids || !args) die("calloc");
-
-  for (int i = 0; i < threads; i++) {
-    args[i].id = i + 1;
-    args[i].port = port;
-    args[i].msg = messages[i % msg_count];
-
-    if (pthread_create(&tids[i], NULL, worker, &args[i]) != 0) {
-      perror("[client] pthread_create");
-      // continue creating others
-    }
-  }
-
-  for (int i = 0; i < threads; i++) {
-    pthread_join(tids[i], NULL);
-  }
-
-  free(tids);
-  free(args);
-  return 0;
-}
-
-
+// client.c
+// Multi-threaded TCP client simulator: creates at least 5 threads.
+// Each thread connects to 127.0.0.1, sends a string, receives processed response, prints it.
+// Handles partial sends/receives with loops.
+// --bench turns it into a load generator: duration- or count-based runs, an
+// optional open-loop request rate, and latency percentiles from a log-linear
+// (HDR-style) histogram. --keepalive reuses each connection for many
+// messages and --pipeline=K keeps K requests in flight per connection.
+// --engine=epoll drives many non-blocking connections from each thread, with
+// a connection ramp-up and optional source address spreading, for tens of
+// thousands of concurrent clients from one box. --framed speaks the server's
+// length-prefixed protocol, where replies may carry a transform trailer.
+// --target points either mode at other server addresses (IPv6, Unix domain
+// sockets, several at once). --engine=shm talks to the server's --shm socket
+// and then exchanges messages through shared-memory rings only (shmring.h).
+// For connection churn, --src-ports binds each connection to a port from a
+// fixed range and --close picks who ends it: a plain close, an RST, or the
+// server (its --close-after), so the load box does not run out of ports or
+// pile up TIME_WAIT.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "frame.h"
+#include "netaddr.h"
+#include "shmring.h"
+#include "sockopt.h"
+
+#define BUF_SIZE 4096
+#define DEFAULT_PORT 5555
+#define DEFAULT_THREADS 5
+#define DEFAULT_DURATION 10.0
+#define DEFAULT_MSG_SIZE 64
+#define MAX_PIPELINE 1024          // IOV_MAX
+#define MAX_PIPELINE_BYTES (1 << 20) // write-all-then-read must fit in socket buffers
+#define MAX_SRC_ADDRS 64
+#define CLOSE_WAIT_MS 1000 // --close=server: how long to wait for the server's FIN
+#define RETRY_MS 10         // epoll engine: pause before reusing a connection that failed
+#define MAX_TARGETS 16
+#define MAX_EVENTS 256
+
+typedef struct {
+  int id;
+  const netaddr_t *target;
+  const char *msg;
+} worker_args_t;
+
+static void die(const char *msg) {
+  perror(msg);
+  exit(EXIT_FAILURE);
+}
+
+static ssize_t send_all(int fd, const void *buf, size_t len) {
+  const unsigned char *p = (const unsigned char *)buf;
+  size_t total = 0;
+
+  while (total < len) {
+    ssize_t n = send(fd, p + total, len - total, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (n == 0) break;
+    total += (size_t)n;
+  }
+  return (ssize_t)total;
+}
+
+// Like send_all, for a scatter list. iov is consumed (modified) as it goes.
+static ssize_t writev_all(int fd, struct iovec *iov, int cnt) {
+  size_t total = 0;
+
+  while (cnt > 0) {
+    ssize_t n = writev(fd, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    total += (size_t)n;
+
+    size_t left = (size_t)n;
+    while (cnt > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (unsigned char *)iov->iov_base + left;
+      iov->iov_len -= left;
+    }
+  }
+  return (ssize_t)total;
+}
+
+// Receive exactly len bytes (advanced-style).
+// For echo: we expect server returns same length as sent.
+// If server closes early, return bytes received so far.
+static ssize_t recv_exact(int fd, void *buf, size_t len) {
+  unsigned char *p = (unsigned char *)buf;
+  size_t total = 0;
+
+  while (total < len) {
+    ssize_t n = recv(fd, p + total, len - total, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    if (n == 0) break; // server closed
+    total += (size_t)n;
+  }
+  return (ssize_t)total;
+}
+
+static void *worker(void *arg) {
+  worker_args_t *a = (worker_args_t *)arg;
+
+  // 1) socket
+  int fd = socket(netaddr_family(a->target), SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("[client] socket");
+    return NULL;
+  }
+
+  // 2) connect to the target (127.0.0.1:port by default)
+  if (connect(fd, netaddr_sa(a->target), a->target->len) < 0) {
+    perror("[client] connect");
+    close(fd);
+    return NULL;
+  }
+
+  // 3) send message
+  size_t len = strlen(a->msg);
+  if (len == 0) {
+    close(fd);
+    return NULL;
+  }
+  if (len > BUF_SIZE) len = BUF_SIZE; // keep it safe
+
+  if (send_all(fd, a->msg, len) < 0) {
+    perror("[client] send");
+    close(fd);
+    return NULL;
+  }
+
+  // 4) recv response (same length)
+  char resp[BUF_SIZE + 1];
+  memset(resp, 0, sizeof(resp));
+
+  ssize_t r = recv_exact(fd, resp, len);
+  if (r < 0) {
+    perror("[client] recv");
+    close(fd);
+    return NULL;
+  }
+  resp[r] = '\0';
+
+  // 5) print
+  printf("[client thread %d] sent: \"%.*s\" | got: \"%s\"\n",
+         a->id, (int)len, a->msg, resp);
+
+  // 6) close socket
+  close(fd);
+  return NULL;
+}
+
+// ---- latency histogram ----
+// Log-linear buckets: values below 2^HIST_SUB_BITS get one bucket each, every
+// power-of-two range above that is split into 2^HIST_SUB_BITS sub-buckets,
+// so any recorded value is known to within ~1.6%. Values are nanoseconds.
+
+#define HIST_SUB_BITS 6
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40 // ~18 minutes
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total;
+  uint64_t max;
+} hist_t;
+
+static int hist_index(uint64_t v) {
+  if (v < HIST_SUB) return (int)v;
+  int msb = 63 - __builtin_clzll(v);
+  if (msb >= HIST_MAX_BITS) return HIST_BUCKETS - 1;
+  int shift = msb - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB + (int)((v >> shift) - HIST_SUB);
+}
+
+// Highest value that maps to bucket idx.
+static uint64_t hist_value(int idx) {
+  if (idx < HIST_SUB) return (uint64_t)idx;
+  int shift = idx / HIST_SUB - 1;
+  uint64_t sub = (uint64_t)(idx % HIST_SUB) + HIST_SUB;
+  return ((sub + 1) << shift) - 1;
+}
+
+static void hist_record(hist_t *h, uint64_t v) {
+  h->counts[hist_index(v)]++;
+  h->total++;
+  if (v > h->max) h->max = v;
+}
+
+static void hist_merge(hist_t *dst, const hist_t *src) {
+  for (int i = 0; i < HIST_BUCKETS; i++) dst->counts[i] += src->counts[i];
+  dst->total += src->total;
+  if (src->max > dst->max) dst->max = src->max;
+}
+
+static uint64_t hist_percentile(const hist_t *h, double pct) {
+  if (h->total == 0) return 0;
+  uint64_t want = (uint64_t)((double)h->total * pct / 100.0 + 0.5);
+  if (want == 0) want = 1;
+  uint64_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= want) return hist_value(i) < h->max ? hist_value(i) : h->max;
+  }
+  return h->max;
+}
+
+// ---- load generator ----
+
+// How a connection per batch ends once its replies are in.
+typedef enum {
+  CLOSE_FIN,    // close(): the client sends the first FIN and keeps the TIME_WAIT
+  CLOSE_RST,    // SO_LINGER 0: an RST, no TIME_WAIT on either side
+  CLOSE_SERVER  // wait for the server's FIN (--close-after), TIME_WAIT is the server's
+} close_mode_t;
+
+typedef struct {
+  netaddr_t targets[MAX_TARGETS]; // server addresses, round-robin per connection
+  int ntargets;
+  int threads;
+  int conns;        // simulated clients per thread, served round-robin
+  long count;       // messages per simulated client, 0 = run for duration
+  double duration;  // seconds, used when count == 0
+  double rate;      // total target msgs/s across threads, 0 = closed loop
+  size_t size;      // payload bytes per message
+  int keepalive;    // keep each simulated client's connection open
+  int pipeline;     // requests written back-to-back before reading replies
+  int epoll_engine; // non-blocking connections driven by one epoll per thread
+  int shm_engine;   // shared-memory sessions on the server's --shm socket
+  double ramp;      // seconds over which connections are opened (epoll engine)
+  netaddr_t src[MAX_SRC_ADDRS]; // source addresses, round-robin per connection
+  int nsrc;
+  int port_lo;      // --src-ports range, 0 = kernel picks
+  int port_hi;
+  close_mode_t close_mode;
+  int framed;       // --framed: varint length header before every message
+  size_t wire_len;  // bytes per request on the wire (size plus any header)
+  sockopt_cfg_t sock; // --nodelay, --rcvbuf, ... as on the server
+  int idle;         // extra connections held open without traffic
+  int json;         // --json: print one JSON record instead of the text report
+} bench_cfg_t;
+
+typedef struct {
+  int id;
+  const bench_cfg_t *cfg;
+  const unsigned char *msg;
+  hist_t hist;
+  uint64_t msgs;
+  uint64_t bytes;
+  uint64_t errors;
+} bench_thread_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t t) {
+  struct timespec ts = {(time_t)(t / 1000000000ull), (long)(t % 1000000000ull)};
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+}
+
+// --src-ports: next port to hand out, shared by all threads so that
+// concurrent connections walk the range instead of colliding in it.
+static unsigned g_port_next;
+
+// Binds fd to local. With --src-ports the port is simply the next one in the
+// range: SO_REUSEADDR is needed to bind a port whose last connection sits in
+// TIME_WAIT (tcp_tw_reuse only helps ports the kernel picks), and it also lets
+// live sockets share a port, so bind() catches no collisions. The connect
+// does: the same 4-tuple twice fails it with EADDRNOTAVAIL and
+// connect_server moves on to the next port. Without --src-ports,
+// IP_BIND_ADDRESS_NO_PORT defers the port to connect(), which then only needs
+// the full 4-tuple to be unique rather than holding a port per source
+// address for every connection.
+static int bind_source(int fd, const bench_cfg_t *cfg, const netaddr_t *local) {
+  int one = 1;
+  struct sockaddr_storage ss = local->ss;
+  if (cfg->port_lo == 0) {
+    setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+    return bind(fd, (struct sockaddr *)&ss, local->len);
+  }
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  unsigned span = (unsigned)(cfg->port_hi - cfg->port_lo + 1);
+  for (unsigned i = 0; i < span; i++) {
+    uint16_t port = htons((uint16_t)(cfg->port_lo +
+                                     __atomic_fetch_add(&g_port_next, 1, __ATOMIC_RELAXED) % span));
+    if (ss.ss_family == AF_INET) {
+      ((struct sockaddr_in *)&ss)->sin_port = port;
+    } else {
+      ((struct sockaddr_in6 *)&ss)->sin6_port = port;
+    }
+    if (bind(fd, (struct sockaddr *)&ss, local->len) == 0) return 0;
+    if (errno != EADDRINUSE) return -1;
+  }
+  errno = EADDRNOTAVAIL;
+  return -1;
+}
+
+// Connects to target cfg->targets[idx % ntargets], optionally from source
+// address cfg->src[idx % nsrc] so that more than ~64k connections fit the
+// 4-tuple space. Only sources of the target's family are used, so a mixed
+// --src list serves IPv4 and IPv6 targets alike. With nonblock set the
+// connect may still be in progress when this returns. A --src-ports port
+// already connected to this very target, or still in TIME_WAIT towards it,
+// fails the connect with EADDRNOTAVAIL; the next one is tried then.
+static int connect_server(const bench_cfg_t *cfg, unsigned idx, int nonblock) {
+  const netaddr_t *t = &cfg->targets[idx % (unsigned)cfg->ntargets];
+  int family = netaddr_family(t);
+  const netaddr_t *local = NULL;
+  netaddr_t any;
+  if (cfg->nsrc > 0 && family != AF_UNIX) {
+    local = &cfg->src[idx % (unsigned)cfg->nsrc];
+    for (int i = 0; i < cfg->nsrc && netaddr_family(local) != family; i++) {
+      local = &cfg->src[(idx + (unsigned)i) % (unsigned)cfg->nsrc];
+    }
+    if (netaddr_family(local) != family) local = NULL;
+  }
+  if (!local && cfg->port_lo && family != AF_UNIX) {
+    memset(&any, 0, sizeof(any));
+    any.ss.ss_family = (sa_family_t)family;
+    any.len = family == AF_INET ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+    local = &any;
+  }
+
+  for (int attempt = 0;; attempt++) {
+    int fd = socket(family, SOCK_STREAM | (nonblock ? SOCK_NONBLOCK : 0), 0);
+    if (fd < 0) return -1;
+    if (local && bind_source(fd, cfg, local) < 0) {
+      close(fd);
+      return -1;
+    }
+
+    const char *bad = sockopt_apply(fd, &cfg->sock, ROLE_CLIENT);
+    static int warned;
+    if (bad && !__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED)) {
+      fprintf(stderr, "[client] setsockopt(%s): %s\n", bad, strerror(errno));
+    }
+
+    if (connect(fd, netaddr_sa(t), t->len) == 0 || (nonblock && errno == EINPROGRESS)) {
+      return fd;
+    }
+    int err = errno;
+    close(fd);
+    if (err != EADDRNOTAVAIL || !cfg->port_lo || attempt == cfg->port_hi - cfg->port_lo) {
+      errno = err;
+      return -1;
+    }
+  }
+}
+
+// Closes a connection the way --close asks; CLOSE_SERVER callers have
+// already seen the server's FIN.
+static void close_conn(const bench_cfg_t *cfg, int fd) {
+  if (cfg->close_mode == CLOSE_RST) {
+    struct linger lg = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+  }
+  close(fd);
+}
+
+static void warn_no_server_close(void) {
+  static int warned;
+  if (!__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED)) {
+    fprintf(stderr, "[client] --close=server: the server did not close (run it with "
+                    "--close-after)\n");
+  }
+}
+
+// --close=server: the server is to close first. Returns 0 once its FIN
+// arrives, -1 on anything else (more data, a reset, CLOSE_WAIT_MS of nothing).
+static int await_server_close(int fd) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  int rc;
+  while ((rc = poll(&pfd, 1, CLOSE_WAIT_MS)) < 0 && errno == EINTR) {
+  }
+  if (rc <= 0) {
+    if (rc == 0) warn_no_server_close();
+    return -1;
+  }
+  char b;
+  ssize_t n;
+  while ((n = recv(fd, &b, 1, 0)) < 0 && errno == EINTR) {
+  }
+  return n == 0 ? 0 : -1;
+}
+
+// Follows a --framed reply stream, whose frames may be longer than the
+// request (a checksum trailer), counting the frames that complete.
+typedef struct {
+  int in_payload;
+  int shift;
+  uint64_t len; // header: length so far; payload: bytes left
+} reply_reader_t;
+
+// Returns the number of frames completed by p[0..n), or -1 on a bad header.
+static int reply_feed(reply_reader_t *rr, const unsigned char *p, size_t n) {
+  int frames = 0;
+  size_t i = 0;
+  while (i < n) {
+    if (rr->in_payload) {
+      size_t k = n - i;
+      if (k > rr->len) k = (size_t)rr->len;
+      i += k;
+      rr->len -= k;
+    } else {
+      int st = frame_len_step(&rr->len, &rr->shift, p[i++]);
+      if (st < 0) return -1;
+      if (st == 0) continue;
+      rr->in_payload = 1;
+      rr->shift = 0;
+    }
+    if (rr->in_payload && rr->len == 0) {
+      rr->in_payload = 0;
+      frames++;
+    }
+  }
+  return frames;
+}
+
+// Reads until depth reply frames have arrived.
+static int recv_frames(int fd, unsigned char *buf, size_t cap, int depth) {
+  reply_reader_t rr = {0, 0, 0};
+  int frames = 0;
+  while (frames < depth) {
+    ssize_t n = recv(fd, buf, cap, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    int f = reply_feed(&rr, buf, (size_t)n);
+    if (f < 0) return -1;
+    frames += f;
+  }
+  return 0;
+}
+
+// Writes depth copies of msg in one writev, then reads the combined echo
+// with a single recv_exact. Without keep-alive the connection is opened and
+// closed around every batch, the way worker() does it.
+static int bench_batch(const bench_cfg_t *cfg, int *fdp, unsigned idx, const unsigned char *msg,
+                       unsigned char *resp, int depth) {
+  int fd = *fdp;
+  if (fd < 0) fd = connect_server(cfg, idx, 0);
+  if (fd < 0) return -1;
+
+  struct iovec iov[MAX_PIPELINE];
+  for (int i = 0; i < depth; i++) {
+    iov[i].iov_base = (void *)msg;
+    iov[i].iov_len = cfg->wire_len;
+  }
+  ssize_t want = (ssize_t)(cfg->wire_len * (size_t)depth);
+
+  int ok = writev_all(fd, iov, depth) == want;
+  if (ok && cfg->framed) {
+    ok = recv_frames(fd, resp, cfg->wire_len * (size_t)depth, depth) == 0;
+  } else if (ok) {
+    ok = recv_exact(fd, resp, (size_t)want) == want;
+  }
+  if (ok && !cfg->keepalive && cfg->close_mode == CLOSE_SERVER) ok = await_server_close(fd) == 0;
+  if (!ok || !cfg->keepalive) {
+    close_conn(cfg, fd);
+    fd = -1;
+  }
+  *fdp = fd;
+  return ok ? 0 : -1;
+}
+
+// bench_batch over a shared-memory session: the requests are written into
+// the ring in place, then the replies are read back the same way. The
+// session, like a keep-alive connection, lasts for the run.
+static int bench_batch_shm(const bench_cfg_t *cfg, shm_conn_t *c, int *fdp, unsigned idx,
+                           const unsigned char *msg, int depth) {
+  if (*fdp < 0) {
+    int fd = connect_server(cfg, idx, 0);
+    if (fd < 0) return -1;
+    if (shm_attach(c, fd) < 0) {
+      close(fd);
+      return -1;
+    }
+    *fdp = fd;
+    // Every request of a batch is written before any reply is read.
+    if ((size_t)depth * (cfg->size + 16) > c->out.cap / 2) {
+      fprintf(stderr, "[client] --pipeline * --size does not fit the server's --shm-ring\n");
+      exit(1);
+    }
+  }
+
+  for (int i = 0; i < depth; i++) {
+    unsigned char *p;
+    while (!(p = (unsigned char *)shm_reserve(c, cfg->size))) {
+      if (shm_wait(c, cfg->size) < 0) goto fail;
+    }
+    memcpy(p, msg, cfg->size);
+    shm_commit(c, cfg->size);
+  }
+  for (int i = 0; i < depth; i++) {
+    size_t len;
+    while (!shm_peek(c, &len)) {
+      if (shm_wait(c, 0) < 0) goto fail;
+    }
+    shm_release(c);
+  }
+  return 0;
+
+fail:
+  shm_close(c);
+  *fdp = -1;
+  return -1;
+}
+
+// Open loop: request k is due at start + k * interval whether or not the
+// previous one finished, and its latency is measured from that due time.
+// A stall therefore shows up in every request it delays instead of being
+// hidden by a client that politely waits (coordinated omission). A pipelined
+// batch goes out when its last request is due.
+static void *bench_thread(void *arg) {
+  bench_thread_t *t = (bench_thread_t *)arg;
+  const bench_cfg_t *cfg = t->cfg;
+  int depth = cfg->pipeline;
+
+  unsigned char *resp = (unsigned char *)malloc(cfg->wire_len * (size_t)depth);
+  int *fds = (int *)malloc(sizeof(int) * (size_t)cfg->conns);
+  shm_conn_t *shms = (shm_conn_t *)calloc((size_t)cfg->conns, sizeof(shm_conn_t));
+  if (!resp || !fds || !shms) die("malloc");
+  for (int i = 0; i < cfg->conns; i++) fds[i] = -1;
+
+  uint64_t interval = 0;
+  if (cfg->rate > 0) interval = (uint64_t)(1e9 * cfg->threads / cfg->rate);
+
+  uint64_t start = now_ns();
+  uint64_t deadline = start + (uint64_t)(cfg->duration * 1e9);
+  uint64_t limit = cfg->count > 0 ? (uint64_t)cfg->count * (uint64_t)cfg->conns : 0;
+  int slot = 0;
+
+  for (uint64_t k = 0; limit ? k < limit : 1; k += (uint64_t)depth) {
+    int n = depth;
+    if (limit && k + (uint64_t)n > limit) n = (int)(limit - k);
+
+    uint64_t first_due = start + k * interval;
+    uint64_t last_due = first_due + (uint64_t)(n - 1) * interval;
+    if (interval && last_due > now_ns()) sleep_until_ns(last_due);
+    uint64_t t0 = interval ? first_due : now_ns();
+    if (!limit && t0 >= deadline) break;
+
+    int rc = cfg->shm_engine
+                 ? bench_batch_shm(cfg, &shms[slot], &fds[slot], (unsigned)slot, t->msg, n)
+                 : bench_batch(cfg, &fds[slot], (unsigned)slot, t->msg, resp, n);
+    uint64_t done = now_ns();
+    slot = (slot + 1) % cfg->conns;
+
+    if (rc < 0) {
+      t->errors += (uint64_t)n;
+      continue;
+    }
+    for (int i = 0; i < n; i++) hist_record(&t->hist, done - (t0 + (uint64_t)i * interval));
+    t->msgs += (uint64_t)n;
+    t->bytes += 2 * cfg->size * (uint64_t)n;
+  }
+
+  for (int i = 0; i < cfg->conns; i++) {
+    if (fds[i] < 0) continue;
+    if (cfg->shm_engine) {
+      shm_close(&shms[i]); // closes fds[i] too
+    } else {
+      close_conn(cfg, fds[i]);
+    }
+  }
+  free(shms);
+  free(fds);
+  free(resp);
+  return NULL;
+}
+
+// ---- epoll engine ----
+// Every thread owns cfg->conns non-blocking connections and one epoll set.
+// A connection cycles CONNECTING -> SENDING -> RECEIVING and back to SENDING
+// (or IDLE, through CLOSING with --close=server) for the next batch. Idle
+// connections wait in a min-heap keyed by when they are due next: their first
+// connect time during ramp-up, their next open-loop request, or a reconnect
+// after an error.
+
+typedef enum {
+  EC_IDLE,       // waiting in the heap
+  EC_CONNECTING,
+  EC_SENDING,
+  EC_RECEIVING,
+  EC_CLOSING     // --close=server: replies are in, waiting in the heap for the
+                 // server's FIN, for CLOSE_WAIT_MS at most
+} econn_state_t;
+
+typedef struct {
+  int fd;
+  unsigned idx;       // connection number within the thread, picks the source address
+  econn_state_t state;
+  int batch;          // requests in the current batch
+  size_t sent;
+  size_t received;
+  int frames;         // --framed: replies completed in this batch
+  reply_reader_t rr;
+  uint64_t due;       // IDLE: when to act; CLOSING: when to give up on the FIN;
+                      // otherwise t0 of the batch in flight
+  uint64_t next_k;    // open loop: index of this connection's next request
+  long done_msgs;     // for --count
+  int hpos;           // index in the heap, -1 while not in it
+} econn_t;
+
+typedef struct {
+  econn_t **items;
+  int len;
+} eheap_t;
+
+static void eheap_place(eheap_t *h, int i, econn_t *c) {
+  h->items[i] = c;
+  c->hpos = i;
+}
+
+static void eheap_sift_up(eheap_t *h, int i, econn_t *c) {
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (h->items[parent]->due <= c->due) break;
+    eheap_place(h, i, h->items[parent]);
+    i = parent;
+  }
+  eheap_place(h, i, c);
+}
+
+static void eheap_sift_down(eheap_t *h, int i, econn_t *c) {
+  while (1) {
+    int l = 2 * i + 1, r = l + 1, m = i;
+    uint64_t md = c->due;
+    if (l < h->len && h->items[l]->due < md) {
+      m = l;
+      md = h->items[l]->due;
+    }
+    if (r < h->len && h->items[r]->due < md) m = r;
+    if (m == i) break;
+    eheap_place(h, i, h->items[m]);
+    i = m;
+  }
+  eheap_place(h, i, c);
+}
+
+static void eheap_push(eheap_t *h, econn_t *c) {
+  eheap_sift_up(h, h->len++, c);
+}
+
+// Takes c out wherever it is; a no-op if it is not in the heap.
+static void eheap_remove(eheap_t *h, econn_t *c) {
+  int i = c->hpos;
+  if (i < 0) return;
+  c->hpos = -1;
+  econn_t *last = h->items[--h->len];
+  if (last == c) return;
+  if (i > 0 && h->items[(i - 1) / 2]->due > last->due) {
+    eheap_sift_up(h, i, last);
+  } else {
+    eheap_sift_down(h, i, last);
+  }
+}
+
+static econn_t *eheap_pop(eheap_t *h) {
+  econn_t *top = h->items[0];
+  eheap_remove(h, top);
+  return top;
+}
+
+typedef struct {
+  bench_thread_t *t;
+  int ep;
+  eheap_t heap;
+  const unsigned char *batchbuf; // cfg->pipeline copies of the message
+  unsigned char scratch[65536];  // replies are counted, not kept
+  uint64_t interval;             // per-connection open-loop spacing, 0 = closed loop
+  uint64_t start;
+  uint64_t deadline;
+  int active;                    // connections that have not finished --count
+} eloop_t;
+
+static void econn_drop(eloop_t *lp, econn_t *c) {
+  if (c->fd >= 0) {
+    epoll_ctl(lp->ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close_conn(lp->t->cfg, c->fd);
+    c->fd = -1;
+  }
+}
+
+// Schedules the connection's next batch, or retires it once --count is met.
+static void econn_idle(eloop_t *lp, econn_t *c, uint64_t now) {
+  const bench_cfg_t *cfg = lp->t->cfg;
+  if (cfg->count > 0 && c->done_msgs >= cfg->count) {
+    econn_drop(lp, c);
+    lp->active--;
+    return;
+  }
+  c->state = EC_IDLE;
+  if (lp->interval) {
+    // The batch leaves when its last request is due.
+    int n = cfg->pipeline;
+    if (cfg->count > 0 && c->done_msgs + n > cfg->count) n = (int)(cfg->count - c->done_msgs);
+    c->due = lp->start + c->idx * (lp->interval / (uint64_t)cfg->conns) +
+             (c->next_k + (uint64_t)n - 1) * lp->interval;
+  } else {
+    c->due = now;
+  }
+  eheap_push(&lp->heap, c);
+}
+
+static void econn_fail(eloop_t *lp, econn_t *c, uint64_t now) {
+  if (c->state == EC_SENDING || c->state == EC_RECEIVING) {
+    lp->t->errors += (uint64_t)c->batch;
+    c->done_msgs += c->batch;
+    c->next_k += (uint64_t)c->batch;
+  } else {
+    lp->t->errors++;
+  }
+  econn_drop(lp, c);
+  econn_idle(lp, c, now);
+  // A connect that fails at once (every --src-ports port taken) would
+  // otherwise come due again in the same pass, for ever.
+  uint64_t retry = now + (uint64_t)RETRY_MS * 1000000;
+  if (c->hpos >= 0 && c->due < retry) {
+    eheap_remove(&lp->heap, c);
+    c->due = retry;
+    eheap_push(&lp->heap, c);
+  }
+}
+
+static void econn_start_batch(eloop_t *lp, econn_t *c, uint64_t now) {
+  const bench_cfg_t *cfg = lp->t->cfg;
+  int n = cfg->pipeline;
+  if (cfg->count > 0 && c->done_msgs + n > cfg->count) n = (int)(cfg->count - c->done_msgs);
+
+  c->batch = n;
+  c->sent = c->received = 0;
+  c->frames = 0;
+  memset(&c->rr, 0, sizeof(c->rr));
+  if (lp->interval) {
+    c->due = lp->start + c->idx * (lp->interval / (uint64_t)cfg->conns) + c->next_k * lp->interval;
+  } else {
+    c->due = now;
+  }
+  c->state = EC_SENDING;
+}
+
+// Drives one connection as far as it can go without blocking.
+static void econn_run(eloop_t *lp, econn_t *c) {
+  const bench_cfg_t *cfg = lp->t->cfg;
+
+  if (c->state == EC_CONNECTING) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+      if (err == EINPROGRESS) return;
+      econn_fail(lp, c, now_ns());
+      return;
+    }
+    if (lp->interval) {
+      // Connected ahead of schedule (ramp-up): wait for the batch to come due.
+      econn_idle(lp, c, now_ns());
+      return;
+    }
+    econn_start_batch(lp, c, now_ns());
+  }
+
+  if (c->state == EC_SENDING) {
+    size_t want = cfg->wire_len * (size_t)c->batch;
+    while (c->sent < want) {
+      ssize_t n = send(c->fd, lp->batchbuf + c->sent, want - c->sent, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+        econn_fail(lp, c, now_ns());
+        return;
+      }
+      c->sent += (size_t)n;
+    }
+    c->state = EC_RECEIVING;
+  }
+
+  if (c->state == EC_RECEIVING) {
+    size_t want = cfg->wire_len * (size_t)c->batch;
+    while (cfg->framed ? c->frames < c->batch : c->received < want) {
+      size_t room = cfg->framed ? sizeof(lp->scratch) : want - c->received;
+      if (room > sizeof(lp->scratch)) room = sizeof(lp->scratch);
+      ssize_t n = recv(c->fd, lp->scratch, room, 0);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+      }
+      int f = n > 0 && cfg->framed ? reply_feed(&c->rr, lp->scratch, (size_t)n) : 0;
+      if (n <= 0 || f < 0) {
+        econn_fail(lp, c, now_ns());
+        return;
+      }
+      c->received += (size_t)n;
+      c->frames += f;
+    }
+    want = cfg->size * (size_t)c->batch;
+
+    uint64_t done = now_ns();
+    bench_thread_t *t = lp->t;
+    for (int i = 0; i < c->batch; i++) {
+      hist_record(&t->hist, done - (c->due + (uint64_t)i * lp->interval));
+    }
+    t->msgs += (uint64_t)c->batch;
+    t->bytes += 2 * want;
+    c->done_msgs += c->batch;
+    c->next_k += (uint64_t)c->batch;
+
+    if (!cfg->keepalive && cfg->close_mode == CLOSE_SERVER) {
+      c->state = EC_CLOSING;
+      c->due = done + (uint64_t)CLOSE_WAIT_MS * 1000000;
+      eheap_push(&lp->heap, c);
+    } else {
+      if (!cfg->keepalive) econn_drop(lp, c);
+      econn_idle(lp, c, done);
+      return;
+    }
+  }
+
+  if (c->state == EC_CLOSING) {
+    ssize_t n;
+    while ((n = recv(c->fd, lp->scratch, 1, 0)) < 0 && errno == EINTR) {
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+    eheap_remove(&lp->heap, c);
+    if (n != 0) {
+      econn_fail(lp, c, now_ns());
+      return;
+    }
+    econn_drop(lp, c);
+    econn_idle(lp, c, now_ns());
+  }
+}
+
+// An IDLE connection came due: open it if needed, then start its batch. A
+// CLOSING one has waited CLOSE_WAIT_MS for the server's FIN in vain.
+static void econn_wake(eloop_t *lp, econn_t *c, uint64_t now) {
+  if (c->state == EC_CLOSING) {
+    warn_no_server_close();
+    econn_fail(lp, c, now);
+    return;
+  }
+  if (c->fd < 0) {
+    c->fd = connect_server(lp->t->cfg, c->idx, 1);
+    if (c->fd < 0) {
+      c->state = EC_CONNECTING;
+      econn_fail(lp, c, now);
+      return;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    if (epoll_ctl(lp->ep, EPOLL_CTL_ADD, c->fd, &ev) < 0) {
+      c->state = EC_CONNECTING;
+      econn_fail(lp, c, now);
+      return;
+    }
+    c->state = EC_CONNECTING;
+    return; // EPOLLOUT reports the connect result
+  }
+  econn_start_batch(lp, c, now);
+  econn_run(lp, c);
+}
+
+static void *bench_thread_epoll(void *arg) {
+  bench_thread_t *t = (bench_thread_t *)arg;
+  const bench_cfg_t *cfg = t->cfg;
+  static __thread eloop_t lp;
+
+  lp.t = t;
+  lp.ep = epoll_create1(0);
+  if (lp.ep < 0) die("epoll_create1");
+
+  size_t bytes = cfg->wire_len * (size_t)cfg->pipeline;
+  unsigned char *batchbuf = (unsigned char *)malloc(bytes);
+  econn_t *conns = (econn_t *)calloc((size_t)cfg->conns, sizeof(econn_t));
+  lp.heap.items = (econn_t **)malloc(sizeof(econn_t *) * (size_t)cfg->conns);
+  if (!batchbuf || !conns || !lp.heap.items) die("malloc");
+  for (int i = 0; i < cfg->pipeline; i++) {
+    memcpy(batchbuf + (size_t)i * cfg->wire_len, t->msg, cfg->wire_len);
+  }
+  lp.batchbuf = batchbuf;
+
+  // Per-connection open-loop spacing: the thread's share of --rate is split
+  // evenly across its connections, each offset by idx / conns of a period.
+  if (cfg->rate > 0) lp.interval = (uint64_t)(1e9 * cfg->threads * cfg->conns / cfg->rate);
+
+  lp.start = now_ns();
+  lp.deadline = lp.start + (uint64_t)((cfg->duration + cfg->ramp) * 1e9);
+  lp.active = cfg->conns;
+
+  // Ramp-up: connection i opens at start + ramp * i / conns.
+  for (int i = 0; i < cfg->conns; i++) {
+    econn_t *c = &conns[i];
+    c->fd = -1;
+    c->idx = (unsigned)i;
+    c->hpos = -1;
+    c->state = EC_IDLE;
+    c->due = lp.start + (uint64_t)(cfg->ramp * 1e9 * i / cfg->conns);
+    eheap_push(&lp.heap, c);
+  }
+  if (lp.interval) lp.start += (uint64_t)(cfg->ramp * 1e9);
+
+  struct epoll_event events[MAX_EVENTS];
+  while (lp.active > 0) {
+    uint64_t now = now_ns();
+    if (cfg->count == 0 && now >= lp.deadline) break;
+
+    while (lp.heap.len > 0 && lp.heap.items[0]->due <= now) {
+      econn_t *c = eheap_pop(&lp.heap);
+      if (cfg->count == 0 && now >= lp.deadline) break;
+      econn_wake(&lp, c, now);
+    }
+    if (lp.active == 0) break; // the last one may have retired just now
+
+    int timeout = -1;
+    if (lp.heap.len > 0) {
+      uint64_t wait = lp.heap.items[0]->due > now ? lp.heap.items[0]->due - now : 0;
+      timeout = (int)((wait + 999999) / 1000000);
+    }
+    if (cfg->count == 0) {
+      uint64_t left = lp.deadline > now ? lp.deadline - now : 0;
+      int dl = (int)((left + 999999) / 1000000);
+      if (timeout < 0 || dl < timeout) timeout = dl;
+    }
+
+    int n = epoll_wait(lp.ep, events, MAX_EVENTS, timeout);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      die("epoll_wait");
+    }
+    for (int i = 0; i < n; i++) {
+      econn_t *c = (econn_t *)events[i].data.ptr;
+      if (c->state == EC_IDLE) continue; // keep-alive socket between batches
+      econn_run(&lp, c);
+    }
+  }
+
+  for (int i = 0; i < cfg->conns; i++) {
+    if (conns[i].state == EC_CLOSING && conns[i].fd >= 0) {
+      warn_no_server_close();
+      t->errors++;
+    }
+    econn_drop(&lp, &conns[i]);
+  }
+  close(lp.ep);
+  free(lp.heap.items);
+  free(conns);
+  free(batchbuf);
+  return NULL;
+}
+
+// 100k sockets need far more than the usual 1024 descriptors.
+static void raise_nofile(size_t want) {
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) < 0) return;
+  if (rl.rlim_cur >= want) return;
+  rl.rlim_cur = want < rl.rlim_max ? want : rl.rlim_max;
+  if (setrlimit(RLIMIT_NOFILE, &rl) < 0 || rl.rlim_cur < want) {
+    fprintf(stderr, "[client] warning: open file limit %llu is below %zu connections\n",
+            (unsigned long long)rl.rlim_cur, want);
+  }
+}
+
+static void bench_report(const bench_cfg_t *cfg, bench_thread_t *ts, double elapsed) {
+  static hist_t all;
+  uint64_t msgs = 0, bytes = 0, errors = 0;
+  for (int i = 0; i < cfg->threads; i++) {
+    hist_merge(&all, &ts[i].hist);
+    msgs += ts[i].msgs;
+    bytes += ts[i].bytes;
+    errors += ts[i].errors;
+  }
+
+  double p50 = (double)hist_percentile(&all, 50.0) / 1e3;
+  double p99 = (double)hist_percentile(&all, 99.0) / 1e3;
+  double p999 = (double)hist_percentile(&all, 99.9) / 1e3;
+  double max = (double)all.max / 1e3;
+  const char *engine = cfg->epoll_engine ? "epoll" : cfg->shm_engine ? "shm" : "thread";
+  static const char *const close_names[] = {"fin", "rst", "server"};
+
+  // One record for scripts (bench/run.sh); latencies in microseconds.
+  if (cfg->json) {
+    printf("{\"engine\": \"%s\", \"threads\": %d, \"conns\": %d, \"idle\": %d, "
+           "\"keepalive\": %d, \"close\": \"%s\", \"pipeline\": %d, \"size\": %zu, \"msgs\": %llu, "
+           "\"errors\": %llu, \"elapsed_s\": %.3f, \"msgs_per_s\": %.1f, \"mb_per_s\": %.2f, "
+           "\"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}\n",
+           engine, cfg->threads, cfg->conns, cfg->idle, cfg->keepalive,
+           close_names[cfg->close_mode], cfg->pipeline, cfg->size,
+           (unsigned long long)msgs, (unsigned long long)errors, elapsed, (double)msgs / elapsed,
+           (double)bytes / elapsed / 1e6, p50, p99, p999, max);
+    return;
+  }
+
+  static const char *const closes[] = {"", ", closed with RST", ", server closes"};
+  printf("[client] %d threads x %d conns (%s engine, %s%s, pipeline %d), %llu msgs in %.2f s, "
+         "%llu errors\n",
+         cfg->threads, cfg->conns, engine, cfg->keepalive ? "keep-alive" : "connection per batch",
+         closes[cfg->close_mode], cfg->pipeline, (unsigned long long)msgs, elapsed,
+         (unsigned long long)errors);
+  if (cfg->idle > 0) printf("[client] %d idle connections held open\n", cfg->idle);
+  printf("[client] throughput: %.1f msgs/s, %.2f MB/s (sent + received)\n",
+         (double)msgs / elapsed, (double)bytes / elapsed / 1e6);
+  printf("[client] latency us: p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n", p50, p99, p999,
+         max);
+}
+
+static int run_bench(const bench_cfg_t *cfg) {
+  unsigned char *msg = (unsigned char *)malloc(cfg->wire_len);
+  pthread_t *tids = (pthread_t *)calloc((size_t)cfg->threads, sizeof(pthread_t));
+  bench_thread_t *ts = (bench_thread_t *)calloc((size_t)cfg->threads, sizeof(bench_thread_t));
+  if (!msg || !tids || !ts) die("calloc");
+
+  size_t hdr = cfg->framed ? frame_put_len(msg, cfg->size) : 0;
+  for (size_t i = 0; i < cfg->size; i++) msg[hdr + i] = (unsigned char)('a' + i % 26);
+
+  size_t nfd = (size_t)cfg->idle + 64;
+  if (cfg->epoll_engine) nfd += (size_t)cfg->threads * (size_t)cfg->conns;
+  raise_nofile(nfd);
+  void *(*fn)(void *) = cfg->epoll_engine ? bench_thread_epoll : bench_thread;
+
+  // Idle connections exist for the whole run; they only cost the server memory
+  // and, for the blocking engines, a thread or worker each.
+  int *idle = (int *)malloc(sizeof(int) * (size_t)(cfg->idle + 1));
+  if (!idle) die("malloc");
+  int nidle = 0;
+  while (nidle < cfg->idle) {
+    int fd = connect_server(cfg, (unsigned)nidle, 0);
+    if (fd < 0) {
+      perror("[client] idle connect");
+      break;
+    }
+    idle[nidle++] = fd;
+  }
+
+  uint64_t start = now_ns();
+  for (int i = 0; i < cfg->threads; i++) {
+    ts[i].id = i + 1;
+    ts[i].cfg = cfg;
+    ts[i].msg = msg;
+    if (pthread_create(&tids[i], NULL, fn, &ts[i]) != 0) die("pthread_create");
+  }
+  for (int i = 0; i < cfg->threads; i++) pthread_join(tids[i], NULL);
+  double elapsed = (double)(now_ns() - start) / 1e9;
+  for (int i = 0; i < nidle; i++) close(idle[i]);
+  free(idle);
+
+  bench_report(cfg, ts, elapsed);
+
+  free(msg);
+  free(tids);
+  free(ts);
+  return 0;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [port] [threads>=5] [--target=ADDR[,ADDR...]]\n"
+          "       %s --bench [port] [threads] [--conns=N] [--duration=SEC | --count=N]\n"
+          "                  [--rate=MSGS_PER_SEC] [--size=BYTES] [--keepalive] [--pipeline=K]\n"
+          "                  [--engine=thread|epoll|shm] [--ramp=SEC] [--src=IP[,IP...]] [--framed]\n"
+          "                  [--nodelay] [--quickack] [--rcvbuf=BYTES] [--sndbuf=BYTES]\n"
+          "                  [--busy-poll=USEC] [--fastopen=1] [--idle=N] [--json]\n"
+          "                  [--src-ports=LO-HI] [--close=fin|rst|server]  connection churn;\n"
+          "                  server: the server closes first (its --close-after);\n"
+          "                  --src-ports ports are bound SO_REUSEADDR, a port already in\n"
+          "                  use only shows at connect and the next one is tried\n"
+          "                  [--target=ADDR[,ADDR...]]  shm: the server's --shm address\n"
+          "       ADDR: 127.0.0.1:PORT, [::1]:PORT, unix:/PATH or unix:@NAME (default\n"
+          "       127.0.0.1 on [port]); --src takes IPv4 and IPv6 addresses\n",
+          prog, prog);
+}
+
+int main(int argc, char **argv) {
+  int port = DEFAULT_PORT;
+  int threads = 0; // 0 = not given
+  int bench = 0;
+  bench_cfg_t cfg = {0};
+  cfg.conns = 1;
+  cfg.duration = DEFAULT_DURATION;
+  cfg.size = DEFAULT_MSG_SIZE;
+  cfg.pipeline = 1;
+  sockopt_defaults(&cfg.sock);
+
+  const char *target_specs[MAX_TARGETS];
+  int ntarget_specs = 0;
+
+  int npos = 0;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    int so = sockopt_parse(&cfg.sock, arg);
+    if (so < 0) {
+      usage(argv[0]);
+      return 1;
+    }
+    if (so > 0) continue;
+    if (strcmp(arg, "--bench") == 0) {
+      bench = 1;
+    } else if (strncmp(arg, "--conns=", 8) == 0) {
+      cfg.conns = atoi(arg + 8);
+    } else if (strncmp(arg, "--duration=", 11) == 0) {
+      cfg.duration = atof(arg + 11);
+    } else if (strncmp(arg, "--count=", 8) == 0) {
+      cfg.count = atol(arg + 8);
+    } else if (strncmp(arg, "--rate=", 7) == 0) {
+      cfg.rate = atof(arg + 7);
+    } else if (strncmp(arg, "--size=", 7) == 0) {
+      cfg.size = (size_t)atol(arg + 7);
+    } else if (strcmp(arg, "--keepalive") == 0) {
+      cfg.keepalive = 1;
+    } else if (strcmp(arg, "--framed") == 0) {
+      cfg.framed = 1;
+    } else if (strncmp(arg, "--idle=", 7) == 0) {
+      cfg.idle = atoi(arg + 7);
+    } else if (strcmp(arg, "--json") == 0) {
+      cfg.json = 1;
+    } else if (strncmp(arg, "--pipeline=", 11) == 0) {
+      cfg.pipeline = atoi(arg + 11);
+      cfg.keepalive = 1; // a pipeline only makes sense on a persistent connection
+    } else if (strncmp(arg, "--engine=", 9) == 0) {
+      if (strcmp(arg + 9, "epoll") == 0) {
+        cfg.epoll_engine = 1;
+      } else if (strcmp(arg + 9, "shm") == 0) {
+        cfg.shm_engine = 1;
+        cfg.keepalive = 1; // a session lasts for the run
+      } else if (strcmp(arg + 9, "thread") != 0) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (strncmp(arg, "--ramp=", 7) == 0) {
+      cfg.ramp = atof(arg + 7);
+    } else if (strncmp(arg, "--src=", 6) == 0) {
+      char list[1024];
+      snprintf(list, sizeof(list), "%s", arg + 6);
+      for (char *save = NULL, *tok = strtok_r(list, ",", &save); tok;
+           tok = strtok_r(NULL, ",", &save)) {
+        if (cfg.nsrc == MAX_SRC_ADDRS || netaddr_parse(&cfg.src[cfg.nsrc], tok, 0) < 0 ||
+            netaddr_family(&cfg.src[cfg.nsrc]) == AF_UNIX) {
+          fprintf(stderr, "[client] bad --src address \"%s\"\n", tok);
+          return 1;
+        }
+        cfg.nsrc++;
+      }
+    } else if (strncmp(arg, "--src-ports=", 12) == 0) {
+      if (sscanf(arg + 12, "%d-%d", &cfg.port_lo, &cfg.port_hi) != 2 || cfg.port_lo <= 0 ||
+          cfg.port_hi > 65535 || cfg.port_lo > cfg.port_hi) {
+        fprintf(stderr, "[client] --src-ports wants LO-HI, e.g. 20000-60999\n");
+        return 1;
+      }
+    } else if (strncmp(arg, "--close=", 8) == 0) {
+      if (strcmp(arg + 8, "fin") == 0) {
+        cfg.close_mode = CLOSE_FIN;
+      } else if (strcmp(arg + 8, "rst") == 0) {
+        cfg.close_mode = CLOSE_RST;
+      } else if (strcmp(arg + 8, "server") == 0) {
+        cfg.close_mode = CLOSE_SERVER;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (strncmp(arg, "--target=", 9) == 0) {
+      // Kept as text: an address without a port takes the positional one.
+      if (ntarget_specs == MAX_TARGETS) {
+        fprintf(stderr, "[client] at most %d --target addresses\n", MAX_TARGETS);
+        return 1;
+      }
+      target_specs[ntarget_specs++] = arg + 9;
+    } else if (arg[0] == '-') {
+      usage(argv[0]);
+      return 1;
+    } else if (npos == 0) {
+      port = atoi(arg);
+      npos++;
+    } else if (npos == 1) {
+      threads = atoi(arg);
+      npos++;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (port <= 0 || port > 65535) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (ntarget_specs == 0) target_specs[ntarget_specs++] = "127.0.0.1";
+  for (int i = 0; i < ntarget_specs; i++) {
+    char list[1024];
+    snprintf(list, sizeof(list), "%s", target_specs[i]);
+    for (char *save = NULL, *tok = strtok_r(list, ",", &save); tok;
+         tok = strtok_r(NULL, ",", &save)) {
+      if (cfg.ntargets == MAX_TARGETS ||
+          netaddr_parse(&cfg.targets[cfg.ntargets], tok, port) < 0) {
+        fprintf(stderr, "[client] bad --target address \"%s\"\n", tok);
+        return 1;
+      }
+      cfg.ntargets++;
+    }
+  }
+
+  if (bench) {
+    cfg.threads = threads > 0 ? threads : 1;
+    if (cfg.conns <= 0 || cfg.duration <= 0 ||
+        cfg.count < 0 || cfg.rate < 0 || cfg.size == 0 || cfg.pipeline <= 0 ||
+        cfg.pipeline > MAX_PIPELINE || cfg.ramp < 0 || cfg.idle < 0) {
+      usage(argv[0]);
+      return 1;
+    }
+    if (cfg.shm_engine) {
+      // Ring records keep message boundaries; the socket only opens the session.
+      for (int i = 0; i < cfg.ntargets; i++) {
+        if (netaddr_family(&cfg.targets[i]) != AF_UNIX) {
+          fprintf(stderr, "[client] --engine=shm needs --target=unix:ADDR (the server's --shm)\n");
+          return 1;
+        }
+      }
+      if (cfg.framed) {
+        fprintf(stderr, "[client] --framed does not apply to --engine=shm\n");
+        return 1;
+      }
+    }
+    if (cfg.close_mode == CLOSE_SERVER && (cfg.keepalive || cfg.shm_engine)) {
+      fprintf(stderr, "[client] --close=server needs a connection per batch (no --keepalive, "
+                      "--pipeline or shm engine)\n");
+      return 1;
+    }
+    unsigned char hdr[FRAME_HDR_MAX];
+    cfg.wire_len = cfg.size + (cfg.framed ? frame_put_len(hdr, cfg.size) : 0);
+    // The whole batch is written before any reply is read, so it has to fit
+    // in the two sockets' buffers or both sides stall on a full send queue.
+    if (cfg.wire_len * (size_t)cfg.pipeline > MAX_PIPELINE_BYTES) {
+      fprintf(stderr, "[client] --pipeline * --size must stay under %d bytes\n",
+              MAX_PIPELINE_BYTES);
+      return 1;
+    }
+    return run_bench(&cfg);
+  }
+
+  if (threads == 0) threads = DEFAULT_THREADS;
+  if (threads < 5) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  const char *messages[] = {
+      "hello from thread!",
+      "system programming is fun",
+      "abcXYZ 123",
+      "Shenkar test",
+      "lowercase -> uppercase"
+  };
+  int msg_count = (int)(sizeof(messages) / sizeof(messages[0]));
+
+  pthread_t *tids = (pthread_t *)calloc((size_t)threads, sizeof(pthread_t));
+  worker_args_t *args = (worker_args_t *)calloc((size_t)threads, sizeof(worker_args_t));
+  if (!tids || !args) die("calloc");
+
+  for (int i = 0; i < threads; i++) {
+    args[i].id = i + 1;
+    args[i].target = &cfg.targets[i % cfg.ntargets];
+    args[i].msg = messages[i % msg_count];
+
+    if (pthread_create(&tids[i], NULL, worker, &args[i]) != 0) {
+      perror("[client] pthread_create");
+      // continue creating others
+    }
+  }
+
+  for (int i = 0; i < threads; i++) {
+    pthread_join(tids[i], NULL);
+  }
+
+  free(tids);
+  free(args);
+  return 0;
+}
+
+
@@ -0,0 +1,95 @@
+// frame.c
+// Incremental decoder for the length-prefixed protocol, see frame.h.
+
+#include "frame.h"
+
+#include <string.h>
+
+int frame_parser_init(frame_parser_t *p, const transform_chain_t *chain) {
+  if (chain->trailer_len > FRAME_PEND_MAX) return -1;
+  memset(p, 0, offsetof(frame_parser_t, ts));
+  return 0;
+}
+
+int frame_run(frame_parser_t *p, const transform_chain_t *chain, const unsigned char *in,
+              size_t n, size_t *used, unsigned char *out, size_t cap, size_t *wrote) {
+  size_t i = 0, o = 0;
+  int rc = 0;
+
+  while (1) {
+    // A header or trailer always goes out before anything that follows it.
+    if (p->pend_off < p->pend_len) {
+      size_t k = p->pend_len - p->pend_off;
+      if (k > cap - o) k = cap - o;
+      memcpy(out + o, p->pend + p->pend_off, k);
+      o += k;
+      p->pend_off += k;
+      if (p->pend_off < p->pend_len) break; // out is full
+    }
+
+    if (p->in_payload) {
+      if (p->len == 0) {
+        // Trailer (possibly empty) closes the response frame.
+        transform_finish(chain, &p->ts, p->pend);
+        p->pend_len = chain->trailer_len;
+        p->pend_off = 0;
+        p->in_payload = 0;
+        p->shift = 0;
+        p->frames++;
+        continue;
+      }
+      size_t k = n - i;
+      if (k > cap - o) k = cap - o;
+      if (k > p->len) k = (size_t)p->len;
+      if (k == 0) break;
+      memcpy(out + o, in + i, k);
+      transform_update(chain, &p->ts, out + o, k);
+      i += k;
+      o += k;
+      p->len -= k;
+      continue;
+    }
+
+    if (i == n) break;
+    int st = frame_len_step(&p->len, &p->shift, in[i++]);
+    if (st < 0) {
+      rc = -1;
+      break;
+    }
+    if (st == 0) continue;
+
+    // The response header covers the payload plus whatever the chain appends.
+    p->pend_len = frame_put_len(p->pend, p->len + chain->trailer_len);
+    p->pend_off = 0;
+    p->in_payload = 1;
+    transform_begin(chain, &p->ts);
+  }
+
+  *used = i;
+  *wrote = o;
+  return rc;
+}
+
+int frame_skip(frame_parser_t *p, const unsigned char *in, size_t n, uint64_t *frames) {
+  size_t i = 0;
+  *frames = 0;
+  while (i < n) {
+    if (p->in_payload) {
+      size_t k = n - i;
+      if (k > p->len) k = (size_t)p->len;
+      i += k;
+      p->len -= k;
+    } else {
+      int st = frame_len_step(&p->len, &p->shift, in[i++]);
+      if (st < 0) return -1;
+      if (st == 0) continue;
+      p->in_payload = 1;
+    }
+    if (p->len == 0) {
+      p->in_payload = 0;
+      p->shift = 0;
+      (*frames)++;
+    }
+  }
+  return 0;
+}
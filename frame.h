@@ -0,0 +1,94 @@
+// frame.h
+// Length-prefixed framing (--framed): every message on the wire is a varint
+// (LEB128, 7 bits per byte, low bits first) payload length followed by the
+// payload. The server answers each frame with one frame holding the
+// transformed payload plus the chain's trailer.
+// frame_parser_t decodes incrementally, so a read may end anywhere inside a
+// header or payload, carry many small frames, or be a slice of a frame far
+// larger than any buffer: payloads are transformed and copied out as they
+// arrive instead of being collected whole.
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "transform.h"
+
+#define FRAME_HDR_MAX 10 // bytes in the longest varint of a uint64_t
+
+// Header plus the largest trailer a chain can produce (MAX_STAGES checksums).
+#define FRAME_PEND_MAX 128
+
+typedef struct {
+  int in_payload;
+  int shift;                          // header bits decoded so far
+  uint64_t len;                       // header: length so far; payload: bytes left
+  unsigned char pend[FRAME_PEND_MAX]; // encoded header or trailer waiting for room
+  size_t pend_len;
+  size_t pend_off;
+  uint64_t frames;                    // frames answered so far
+  transform_state_t ts;
+} frame_parser_t;
+
+// Writes the varint for len, returns its size (1..FRAME_HDR_MAX).
+static inline size_t frame_put_len(unsigned char *out, uint64_t len) {
+  size_t n = 0;
+  while (len >= 0x80) {
+    out[n++] = (unsigned char)(len | 0x80);
+    len >>= 7;
+  }
+  out[n++] = (unsigned char)len;
+  return n;
+}
+
+// Feeds one header byte. Returns 1 once *len is complete, 0 if more bytes
+// follow, -1 for a header longer than 63 bits.
+static inline int frame_len_step(uint64_t *len, int *shift, unsigned char b) {
+  if (*shift >= 63) return -1;
+  *len |= (uint64_t)(b & 0x7f) << *shift;
+  *shift += 7;
+  return (b & 0x80) ? 0 : 1;
+}
+
+// Returns -1 if the chain's trailer does not fit the parser.
+int frame_parser_init(frame_parser_t *p, const transform_chain_t *chain);
+
+// Consumes up to n input bytes and writes at most cap bytes of response
+// stream to out; *used and *wrote report how far it got. Stops when the
+// input is exhausted with nothing left to emit, or when out is full.
+// Returns -1 on a malformed header.
+int frame_run(frame_parser_t *p, const transform_chain_t *chain, const unsigned char *in,
+              size_t n, size_t *used, unsigned char *out, size_t cap, size_t *wrote);
+
+// Non-zero while the parser is inside a request frame (header or payload).
+static inline int frame_partial(const frame_parser_t *p) {
+  return p->in_payload || p->shift > 0;
+}
+
+// Non-zero while a header or trailer is still waiting to be written, i.e.
+// frame_run must be called again (even without new input).
+static inline int frame_pending(const frame_parser_t *p) {
+  return p->pend_off < p->pend_len;
+}
+
+// How many of the avail bytes at in take frame_run to the end of one frame:
+// the one under way, or the next one at a frame boundary. All of them if the
+// frame runs past avail or its header is split or malformed.
+static inline size_t frame_one(const frame_parser_t *p, const unsigned char *in, size_t avail) {
+  if (p->in_payload) return p->len < avail ? (size_t)p->len : avail;
+  uint64_t len = p->len;
+  int shift = p->shift, st = 0;
+  size_t i = 0;
+  while (st == 0 && i < avail) st = frame_len_step(&len, &shift, in[i++]);
+  if (st != 1 || avail - i < len) return avail;
+  return i + (size_t)len;
+}
+
+// Advances the parser over n input bytes without answering them; *frames
+// gets the number of request frames completed. Returns -1 on a malformed
+// header.
+int frame_skip(frame_parser_t *p, const unsigned char *in, size_t n, uint64_t *frames);
+
+#endif
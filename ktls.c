@@ -0,0 +1,251 @@
+// ktls.c
+// OpenSSL handshake, kernel TLS record layer, see ktls.h.
+//
+// OpenSSL keeps its traffic keys to itself, but it reports the TLS 1.3
+// traffic secrets through the key log callback; the key and IV follow from
+// them by HKDF-Expand-Label (RFC 8446 7.3). Two things keep the record
+// sequence numbers at zero when the kernel takes over: no session tickets
+// (the only records OpenSSL would send under the application keys), and
+// the handshake must not have read past the client's Finished.
+
+#define _GNU_SOURCE
+#include "ktls.h"
+
+#include <errno.h>
+#include <linux/tls.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/ssl.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+
+#define SECRET_MAX EVP_MAX_MD_SIZE
+
+struct ktls_session {
+  SSL *ssl;
+  int fd;
+  unsigned char tx[SECRET_MAX]; // server application traffic secret
+  unsigned char rx[SECRET_MAX]; // client application traffic secret
+  size_t tx_len;
+  size_t rx_len;
+};
+
+static SSL_CTX *g_ctx;
+
+static size_t unhex(unsigned char *out, size_t cap, const char *hex) {
+  size_t n = 0;
+  while (n < cap && hex[0] && hex[1]) {
+    unsigned v;
+    if (sscanf(hex, "%2x", &v) != 1) break;
+    out[n++] = (unsigned char)v;
+    hex += 2;
+  }
+  return n;
+}
+
+// Lines look like "SERVER_TRAFFIC_SECRET_0 <client random> <secret>", in hex.
+static void keylog(const SSL *ssl, const char *line) {
+  ktls_session_t *s = (ktls_session_t *)SSL_get_app_data(ssl);
+  const char *secret = strrchr(line, ' ');
+  if (!s || !secret) return;
+  if (strncmp(line, "SERVER_TRAFFIC_SECRET_0 ", 24) == 0) {
+    s->tx_len = unhex(s->tx, sizeof(s->tx), secret + 1);
+  } else if (strncmp(line, "CLIENT_TRAFFIC_SECRET_0 ", 24) == 0) {
+    s->rx_len = unhex(s->rx, sizeof(s->rx), secret + 1);
+  }
+}
+
+int ktls_init(const char *cert_file, const char *key_file) {
+  g_ctx = SSL_CTX_new(TLS_server_method());
+  if (!g_ctx) {
+    ERR_print_errors_fp(stderr);
+    return -1;
+  }
+  // The kernel takes AES-GCM under TLS 1.3; nothing else is offered.
+  SSL_CTX_set_min_proto_version(g_ctx, TLS1_3_VERSION);
+  SSL_CTX_set_ciphersuites(g_ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384");
+  SSL_CTX_set_num_tickets(g_ctx, 0);
+  SSL_CTX_set_session_cache_mode(g_ctx, SSL_SESS_CACHE_OFF);
+  SSL_CTX_set_keylog_callback(g_ctx, keylog);
+
+  if (SSL_CTX_use_certificate_chain_file(g_ctx, cert_file) != 1 ||
+      SSL_CTX_use_PrivateKey_file(g_ctx, key_file, SSL_FILETYPE_PEM) != 1 ||
+      SSL_CTX_check_private_key(g_ctx) != 1) {
+    fprintf(stderr, "[server] cannot load %s / %s:\n", cert_file, key_file);
+    ERR_print_errors_fp(stderr);
+    return -1;
+  }
+  return 0;
+}
+
+// The kernel refuses the ULP on an unconnected socket with ENOTCONN, but
+// only after finding (or loading) the tls module; ENOENT means there is none.
+int ktls_probe(void) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  int rc = setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls"));
+  int err = errno;
+  close(fd);
+  if (rc == 0 || err == ENOTCONN) return 0;
+  errno = err;
+  return -1;
+}
+
+ktls_session_t *ktls_start(int fd) {
+  ktls_session_t *s = (ktls_session_t *)calloc(1, sizeof(*s));
+  if (!s) return NULL;
+  s->fd = fd;
+  s->ssl = SSL_new(g_ctx);
+  if (!s->ssl || SSL_set_fd(s->ssl, fd) != 1) {
+    ktls_free(s);
+    return NULL;
+  }
+  SSL_set_app_data(s->ssl, s);
+  SSL_set_accept_state(s->ssl);
+  return s;
+}
+
+// HKDF-Expand-Label(secret, label, "", len).
+static int expand_label(const EVP_MD *md, const unsigned char *secret, size_t secret_len,
+                        const char *label, unsigned char *out, size_t len) {
+  unsigned char info[2 + 1 + 255 + 1];
+  size_t label_len = 6 + strlen(label);
+  info[0] = (unsigned char)(len >> 8);
+  info[1] = (unsigned char)len;
+  info[2] = (unsigned char)label_len;
+  memcpy(info + 3, "tls13 ", 6);
+  memcpy(info + 9, label, label_len - 6);
+  info[3 + label_len] = 0; // empty context
+
+  EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+  int ok = pctx && EVP_PKEY_derive_init(pctx) > 0 &&
+           EVP_PKEY_CTX_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) > 0 &&
+           EVP_PKEY_CTX_set_hkdf_md(pctx, md) > 0 &&
+           EVP_PKEY_CTX_set1_hkdf_key(pctx, secret, (int)secret_len) > 0 &&
+           EVP_PKEY_CTX_add1_hkdf_info(pctx, info, (int)(4 + label_len)) > 0 &&
+           EVP_PKEY_derive(pctx, out, &len) > 0;
+  EVP_PKEY_CTX_free(pctx);
+  return ok ? 0 : -1;
+}
+
+// One direction: TLS_TX with the server's secret, TLS_RX with the client's.
+static int install_keys(ktls_session_t *s, int dir, const unsigned char *secret,
+                        size_t secret_len) {
+  const SSL_CIPHER *cipher = SSL_get_current_cipher(s->ssl);
+  const EVP_MD *md = SSL_CIPHER_get_handshake_digest(cipher);
+  union {
+    struct tls12_crypto_info_aes_gcm_128 g128;
+    struct tls12_crypto_info_aes_gcm_256 g256;
+  } ci;
+  unsigned char key[32], iv[12];
+  size_t key_len, ci_len;
+
+  switch (SSL_CIPHER_get_protocol_id(cipher)) {
+  case 0x1301: // TLS_AES_128_GCM_SHA256
+    key_len = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+    ci_len = sizeof(ci.g128);
+    break;
+  case 0x1302: // TLS_AES_256_GCM_SHA384
+    key_len = TLS_CIPHER_AES_GCM_256_KEY_SIZE;
+    ci_len = sizeof(ci.g256);
+    break;
+  default:
+    errno = EPROTONOSUPPORT;
+    return -1;
+  }
+  if (!md || expand_label(md, secret, secret_len, "key", key, key_len) < 0 ||
+      expand_label(md, secret, secret_len, "iv", iv, sizeof(iv)) < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // The 12-byte IV splits into the kernel's 4-byte salt and 8-byte iv; the
+  // record sequence starts at zero.
+  memset(&ci, 0, sizeof(ci));
+  if (key_len == TLS_CIPHER_AES_GCM_128_KEY_SIZE) {
+    ci.g128.info.version = TLS_1_3_VERSION;
+    ci.g128.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+    memcpy(ci.g128.salt, iv, TLS_CIPHER_AES_GCM_128_SALT_SIZE);
+    memcpy(ci.g128.iv, iv + TLS_CIPHER_AES_GCM_128_SALT_SIZE, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+    memcpy(ci.g128.key, key, key_len);
+  } else {
+    ci.g256.info.version = TLS_1_3_VERSION;
+    ci.g256.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+    memcpy(ci.g256.salt, iv, TLS_CIPHER_AES_GCM_256_SALT_SIZE);
+    memcpy(ci.g256.iv, iv + TLS_CIPHER_AES_GCM_256_SALT_SIZE, TLS_CIPHER_AES_GCM_256_IV_SIZE);
+    memcpy(ci.g256.key, key, key_len);
+  }
+  int rc = setsockopt(s->fd, SOL_TLS, dir, &ci, (socklen_t)ci_len);
+  OPENSSL_cleanse(key, sizeof(key));
+  OPENSSL_cleanse(iv, sizeof(iv));
+  OPENSSL_cleanse(&ci, sizeof(ci));
+  return rc;
+}
+
+ktls_status_t ktls_handshake(ktls_session_t *s) {
+  int rc = SSL_do_handshake(s->ssl);
+  if (rc != 1) {
+    switch (SSL_get_error(s->ssl, rc)) {
+    case SSL_ERROR_WANT_READ:
+      return KTLS_WANT_READ;
+    case SSL_ERROR_WANT_WRITE:
+      return KTLS_WANT_WRITE;
+    default:
+      ERR_clear_error();
+      errno = ECONNABORTED;
+      return KTLS_FAILED;
+    }
+  }
+
+  // Bytes OpenSSL already pulled off the socket would be lost to the kernel.
+  if (SSL_has_pending(s->ssl) || s->tx_len == 0 || s->rx_len == 0) {
+    errno = EPROTO;
+    return KTLS_FAILED;
+  }
+  if (setsockopt(s->fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) < 0 ||
+      install_keys(s, TLS_TX, s->tx, s->tx_len) < 0 ||
+      install_keys(s, TLS_RX, s->rx, s->rx_len) < 0) {
+    return KTLS_FAILED;
+  }
+  return KTLS_DONE;
+}
+
+void ktls_free(ktls_session_t *s) {
+  if (!s) return;
+  SSL_free(s->ssl); // SSL_set_fd's BIO leaves the descriptor open
+  OPENSSL_cleanse(s, sizeof(*s));
+  free(s);
+}
+
+int ktls_accept(int fd, long timeout_ms) {
+  ktls_session_t *s = ktls_start(fd);
+  if (!s) return -1;
+
+  ktls_status_t st;
+  while ((st = ktls_handshake(s)) == KTLS_WANT_READ || st == KTLS_WANT_WRITE) {
+    struct pollfd pfd = {fd, st == KTLS_WANT_READ ? POLLIN : POLLOUT, 0};
+    int rc = poll(&pfd, 1, timeout_ms ? (int)timeout_ms : -1);
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) {
+      if (rc == 0) errno = ETIMEDOUT;
+      st = KTLS_FAILED;
+      break;
+    }
+  }
+  int saved = errno;
+  ktls_free(s);
+  errno = saved;
+  return st == KTLS_DONE ? 0 : -1;
+}
@@ -0,0 +1,45 @@
+// ktls.h
+// TLS termination that leaves the record layer to the kernel: OpenSSL runs
+// the TLS 1.3 handshake, then the traffic keys go to Linux kernel TLS
+// (setsockopt TCP_ULP "tls", TLS_TX and TLS_RX). From there on the socket
+// reads and writes plaintext through plain recv/send/writev/splice, so the
+// engines' data paths need no change and no user-space copy is encrypted.
+// Only built with `make TLS=1` (HAVE_OPENSSL).
+//
+// The kernel hands back application data only: any other record after the
+// handshake (a close_notify alert, a KeyUpdate) fails recv with EIO, which
+// the server takes as the end of the stream.
+
+#ifndef KTLS_H
+#define KTLS_H
+
+typedef struct ktls_session ktls_session_t;
+
+typedef enum {
+  KTLS_FAILED = -1,
+  KTLS_DONE = 0,     // keys are in the kernel; free the session
+  KTLS_WANT_READ,
+  KTLS_WANT_WRITE
+} ktls_status_t;
+
+// Loads the certificate chain and key. Returns 0, or -1 after printing why.
+int ktls_init(const char *cert_file, const char *key_file);
+
+// 0 if the kernel offers the "tls" ULP, -1 with errno set otherwise.
+int ktls_probe(void);
+
+// Starts a server-side handshake on a connected TCP socket; NULL on failure.
+ktls_session_t *ktls_start(int fd);
+
+// Advances the handshake as far as the socket allows. Once it completes the
+// keys are installed on the socket and KTLS_DONE is returned.
+ktls_status_t ktls_handshake(ktls_session_t *s);
+
+// Releases the OpenSSL state; the socket itself stays open.
+void ktls_free(ktls_session_t *s);
+
+// The whole handshake on one socket, blocking or not, giving up after
+// timeout_ms without progress (0 = wait forever). Returns 0 or -1.
+int ktls_accept(int fd, long timeout_ms);
+
+#endif
@@ -0,0 +1,179 @@
+// metrics.c
+// Prometheus text rendering and the admin HTTP endpoint, see metrics.h.
+
+#define _GNU_SOURCE
+#include "metrics.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define METRICS_REQ_MAX 2048
+#define METRICS_IO_TIMEOUT_SEC 2 // a stuck scraper must not wedge the endpoint
+
+void hist_snap_add(hist_snap_t *s, const hist_t *h) {
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    s->count[i] += atomic_load_explicit(&h->count[i], memory_order_relaxed);
+  }
+  s->sum += atomic_load_explicit(&h->sum, memory_order_relaxed);
+}
+
+void mbuf_printf(mbuf_t *mb, const char *fmt, ...) {
+  while (1) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(mb->data ? mb->data + mb->len : NULL, mb->cap - mb->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n < mb->cap - mb->len) {
+      mb->len += (size_t)n;
+      return;
+    }
+    size_t cap = mb->cap ? mb->cap * 2 : 16384;
+    while (cap - mb->len <= (size_t)n) cap *= 2;
+    char *p = (char *)realloc(mb->data, cap);
+    if (!p) return; // the scrape comes out truncated rather than not at all
+    mb->data = p;
+    mb->cap = cap;
+  }
+}
+
+void metrics_header(mbuf_t *mb, const char *name, const char *type, const char *help) {
+  mbuf_printf(mb, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void metrics_u64(mbuf_t *mb, const char *name, const char *labels, uint64_t v) {
+  if (labels) {
+    mbuf_printf(mb, "%s{%s} %llu\n", name, labels, (unsigned long long)v);
+  } else {
+    mbuf_printf(mb, "%s %llu\n", name, (unsigned long long)v);
+  }
+}
+
+void metrics_double(mbuf_t *mb, const char *name, const char *labels, double v) {
+  if (labels) {
+    mbuf_printf(mb, "%s{%s} %.9g\n", name, labels, v);
+  } else {
+    mbuf_printf(mb, "%s %.9g\n", name, v);
+  }
+}
+
+void metrics_histogram(mbuf_t *mb, const char *name, const char *help, const hist_snap_t *h,
+                       double unit) {
+  metrics_header(mb, name, "histogram", help);
+
+  uint64_t total = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) total += h->count[i];
+  // The last bucket also holds everything larger, so it only shows as +Inf.
+  int top = HIST_BUCKETS - 2;
+  while (top > 0 && h->count[top] == 0) top--;
+
+  uint64_t cum = 0;
+  for (int i = 0; i <= top; i++) {
+    cum += h->count[i];
+    mbuf_printf(mb, "%s_bucket{le=\"%.9g\"} %llu\n", name, (double)((uint64_t)1 << i) * unit,
+                (unsigned long long)cum);
+  }
+  mbuf_printf(mb, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)total);
+  mbuf_printf(mb, "%s_sum %.9g\n", name, (double)h->sum * unit);
+  mbuf_printf(mb, "%s_count %llu\n", name, (unsigned long long)total);
+}
+
+int metrics_listen(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+
+  int opt = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((uint16_t)port);
+  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  return fd;
+}
+
+static void send_text(int fd, const char *p, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+}
+
+// Reads up to the end of the request headers; returns the bytes read, or -1.
+static ssize_t read_request(int fd, char *buf, size_t cap) {
+  size_t len = 0;
+  while (len < cap - 1) {
+    ssize_t n = recv(fd, buf + len, cap - 1 - len, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    len += (size_t)n;
+    buf[len] = '\0';
+    if (strstr(buf, "\r\n\r\n") || strstr(buf, "\n\n")) break;
+  }
+  return (ssize_t)len;
+}
+
+void metrics_serve(int listen_fd, void (*render)(mbuf_t *mb)) {
+  mbuf_t body = {NULL, 0, 0};
+  char req[METRICS_REQ_MAX];
+  struct timeval tv = {METRICS_IO_TIMEOUT_SEC, 0};
+
+  while (1) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno != EINTR && errno != ECONNABORTED) {
+        perror("[server] accept(metrics)");
+        sleep(1); // e.g. EMFILE: the reactors' spare descriptors are not ours to take
+      }
+      continue;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (read_request(fd, req, sizeof(req)) < 0) {
+      close(fd);
+      continue;
+    }
+
+    char head[160];
+    int hl;
+    if (strncmp(req, "GET /metrics ", 13) == 0 || strncmp(req, "GET /metrics?", 13) == 0) {
+      body.len = 0;
+      render(&body);
+      hl = snprintf(head, sizeof(head),
+                    "HTTP/1.0 200 OK\r\n"
+                    "Content-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: %zu\r\n"
+                    "Connection: close\r\n\r\n",
+                    body.len);
+      send_text(fd, head, (size_t)hl);
+      send_text(fd, body.data, body.len);
+    } else {
+      static const char not_found[] =
+          "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+      send_text(fd, not_found, sizeof(not_found) - 1);
+    }
+    close(fd);
+  }
+}
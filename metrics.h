@@ -0,0 +1,63 @@
+// metrics.h
+// Prometheus text exposition for the server's --metrics-port admin endpoint.
+// Hot paths only bump relaxed atomics (counters, log2 histograms); the text
+// is rendered on the admin thread when a scraper asks for GET /metrics.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bucket i counts values below 2^i, so 40 buckets cover ~18 minutes in ns.
+#define HIST_BUCKETS 40
+
+typedef struct {
+  _Atomic uint64_t count[HIST_BUCKETS];
+  _Atomic uint64_t sum;
+} hist_t;
+
+// Plain sum of any number of hist_t, for rendering.
+typedef struct {
+  uint64_t count[HIST_BUCKETS];
+  uint64_t sum;
+} hist_snap_t;
+
+static inline void hist_observe(hist_t *h, uint64_t v) {
+  int b = v ? 64 - __builtin_clzll(v) : 0;
+  if (b >= HIST_BUCKETS) b = HIST_BUCKETS - 1;
+  atomic_fetch_add_explicit(&h->count[b], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+}
+
+void hist_snap_add(hist_snap_t *s, const hist_t *h);
+
+// Growable text buffer the exposition is rendered into.
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} mbuf_t;
+
+void mbuf_printf(mbuf_t *mb, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// One "# HELP" / "# TYPE" pair per metric family, then its samples.
+// labels is either NULL or the inside of the braces, e.g. "reactor=\"0\"".
+void metrics_header(mbuf_t *mb, const char *name, const char *type, const char *help);
+void metrics_u64(mbuf_t *mb, const char *name, const char *labels, uint64_t v);
+void metrics_double(mbuf_t *mb, const char *name, const char *labels, double v);
+
+// Renders a whole histogram family; unit scales raw values (1e-9 turns ns
+// into seconds). Empty top buckets are folded into +Inf.
+void metrics_histogram(mbuf_t *mb, const char *name, const char *help, const hist_snap_t *h,
+                       double unit);
+
+// Blocking loopback listener for the admin port; -1 with errno set on failure.
+int metrics_listen(int port);
+
+// Answers GET /metrics with render()'s output and anything else with 404,
+// one connection at a time. Never returns.
+void metrics_serve(int listen_fd, void (*render)(mbuf_t *mb));
+
+#endif
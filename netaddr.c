@@ -0,0 +1,87 @@
+// netaddr.c
+// Command-line socket addresses, see netaddr.h.
+
+#include "netaddr.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/un.h>
+
+static int parse_port(const char *s, int *port) {
+  char *end;
+  long v = strtol(s, &end, 10);
+  if (end == s || *end || v < 0 || v > 65535) return -1;
+  *port = (int)v;
+  return 0;
+}
+
+static int parse_unix(netaddr_t *a, const char *path) {
+  struct sockaddr_un *un = (struct sockaddr_un *)&a->ss;
+  size_t n = strlen(path);
+  un->sun_family = AF_UNIX;
+  if (path[0] == '@') {
+    // Abstract: a leading NUL, and the length says where the name ends.
+    if (n < 2 || n > sizeof(un->sun_path)) return -1;
+    un->sun_path[0] = '\0';
+    memcpy(un->sun_path + 1, path + 1, n - 1);
+    a->len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + n);
+  } else {
+    if (n == 0 || n >= sizeof(un->sun_path)) return -1;
+    memcpy(un->sun_path, path, n + 1);
+    a->len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + n + 1);
+  }
+  snprintf(a->text, sizeof(a->text), "unix:%s", path);
+  return 0;
+}
+
+int netaddr_parse(netaddr_t *a, const char *spec, int default_port) {
+  memset(a, 0, sizeof(*a));
+  if (strncmp(spec, "unix:", 5) == 0) return parse_unix(a, spec + 5);
+
+  char host[INET6_ADDRSTRLEN + 2];
+  int port = default_port;
+  const char *colon = strrchr(spec, ':');
+
+  if (spec[0] == '[') {
+    const char *close = strchr(spec, ']');
+    if (!close || (size_t)(close - spec - 1) >= sizeof(host)) return -1;
+    memcpy(host, spec + 1, (size_t)(close - spec - 1));
+    host[close - spec - 1] = '\0';
+    if (close[1] == ':') {
+      if (parse_port(close + 2, &port) < 0) return -1;
+    } else if (close[1] != '\0') {
+      return -1;
+    }
+  } else if (colon && strchr(spec, ':') == colon) {
+    // Exactly one colon: IPv4 with a port.
+    if ((size_t)(colon - spec) >= sizeof(host)) return -1;
+    memcpy(host, spec, (size_t)(colon - spec));
+    host[colon - spec] = '\0';
+    if (parse_port(colon + 1, &port) < 0) return -1;
+  } else {
+    // No colon (IPv4) or several (bare IPv6): no port.
+    if (strlen(spec) >= sizeof(host)) return -1;
+    strcpy(host, spec);
+  }
+
+  struct sockaddr_in *in4 = (struct sockaddr_in *)&a->ss;
+  struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)&a->ss;
+  if (inet_pton(AF_INET, host, &in4->sin_addr) == 1) {
+    in4->sin_family = AF_INET;
+    in4->sin_port = htons((uint16_t)port);
+    a->len = sizeof(*in4);
+    snprintf(a->text, sizeof(a->text), "%s:%d", host, port);
+  } else if (inet_pton(AF_INET6, host, &in6->sin6_addr) == 1) {
+    in6->sin6_family = AF_INET6;
+    in6->sin6_port = htons((uint16_t)port);
+    a->len = sizeof(*in6);
+    snprintf(a->text, sizeof(a->text), "[%s]:%d", host, port);
+  } else {
+    return -1;
+  }
+  return 0;
+}
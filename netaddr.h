@@ -0,0 +1,34 @@
+// netaddr.h
+// Socket addresses given on the command line, shared by the server
+// (--listen) and the client (--target, --src):
+//   127.0.0.1:5555  0.0.0.0:5555  [::1]:5555  [::]:5555
+//   unix:/run/echo.sock   a Unix domain stream socket
+//   unix:@echo            the same in the abstract namespace (no file)
+// An IPv4 address, a bare IPv6 address or a bracketed one may leave out the
+// port, which then defaults.
+
+#ifndef NETADDR_H
+#define NETADDR_H
+
+#include <sys/socket.h>
+
+#define NETADDR_TEXT_MAX 128
+
+typedef struct {
+  struct sockaddr_storage ss;
+  socklen_t len;
+  char text[NETADDR_TEXT_MAX]; // canonical form, for messages
+} netaddr_t;
+
+// Returns 0, or -1 if spec is not an address in one of the forms above.
+int netaddr_parse(netaddr_t *a, const char *spec, int default_port);
+
+static inline int netaddr_family(const netaddr_t *a) {
+  return a->ss.ss_family;
+}
+
+static inline const struct sockaddr *netaddr_sa(const netaddr_t *a) {
+  return (const struct sockaddr *)&a->ss;
+}
+
+#endif
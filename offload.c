@@ -0,0 +1,172 @@
+// offload.c
+// Work-stealing offload pool, see offload.h.
+//
+// The deque is the fixed-size variant of Chase and Lev's, after Le et al.,
+// "Correct and Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013),
+// with their seq_cst fences folded into seq_cst accesses to top and bottom:
+// the same instructions on x86, and sanitizers see the ordering. A full
+// deque is left to the caller rather than grown: a reactor that far behind
+// is better off running the job itself.
+
+#define _GNU_SOURCE
+#include "offload.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define DEQUE_MASK (OFFLOAD_DEQUE_CAP - 1)
+
+static offload_queue_t *g_queues[OFFLOAD_MAX_QUEUES];
+static _Atomic int g_nqueues;
+
+// Sleeping pool threads. A submitter only takes the lock when g_sleepers says
+// someone waits; a thread counts itself in before its last look at the
+// deques, and all four accesses are seq_cst, so one side always sees the other.
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_wake = PTHREAD_COND_INITIALIZER;
+static _Atomic int g_sleepers;
+
+int offload_queue_init(offload_queue_t *q) {
+  atomic_init(&q->top, 0);
+  atomic_init(&q->bottom, 0);
+  atomic_init(&q->done, NULL);
+  q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (q->efd < 0) return -1;
+
+  pthread_mutex_lock(&g_lock);
+  int n = atomic_load_explicit(&g_nqueues, memory_order_relaxed);
+  if (n == OFFLOAD_MAX_QUEUES) {
+    pthread_mutex_unlock(&g_lock);
+    close(q->efd);
+    q->efd = -1;
+    errno = ENOSPC;
+    return -1;
+  }
+  g_queues[n] = q;
+  atomic_store_explicit(&g_nqueues, n + 1, memory_order_release);
+  pthread_mutex_unlock(&g_lock);
+  return 0;
+}
+
+int offload_submit(offload_queue_t *q, offload_job_t *j) {
+  j->home = q;
+  int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+  int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+  if (b - t >= OFFLOAD_DEQUE_CAP) return -1;
+  atomic_store_explicit(&q->slots[b & DEQUE_MASK], j, memory_order_relaxed);
+  atomic_store(&q->bottom, b + 1);
+
+  if (atomic_load(&g_sleepers) > 0) {
+    pthread_mutex_lock(&g_lock);
+    pthread_cond_signal(&g_wake);
+    pthread_mutex_unlock(&g_lock);
+  }
+  return 0;
+}
+
+offload_job_t *offload_take(offload_queue_t *q) {
+  int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+  atomic_store(&q->bottom, b);
+  int64_t t = atomic_load(&q->top);
+
+  offload_job_t *j = NULL;
+  if (t <= b) {
+    j = atomic_load_explicit(&q->slots[b & DEQUE_MASK], memory_order_relaxed);
+    if (t == b) {
+      // The last job: a thief may be after it too, and the CAS on top decides.
+      if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1, memory_order_seq_cst,
+                                                   memory_order_relaxed)) {
+        j = NULL;
+      }
+      atomic_store(&q->bottom, b + 1);
+    }
+  } else {
+    atomic_store(&q->bottom, b + 1);
+  }
+  return j;
+}
+
+int offload_queued(offload_queue_t *q) {
+  return atomic_load_explicit(&q->bottom, memory_order_relaxed) >
+         atomic_load_explicit(&q->top, memory_order_relaxed);
+}
+
+// The oldest job in q, or NULL once q is empty. Losing the CAS means another
+// thread got that job, so try the next one.
+static offload_job_t *steal(offload_queue_t *q) {
+  while (1) {
+    int64_t t = atomic_load(&q->top);
+    int64_t b = atomic_load(&q->bottom);
+    if (t >= b) return NULL;
+    offload_job_t *j = atomic_load_explicit(&q->slots[t & DEQUE_MASK], memory_order_relaxed);
+    if (atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1, memory_order_seq_cst,
+                                                memory_order_relaxed)) {
+      return j;
+    }
+  }
+}
+
+static offload_job_t *find_job(int self) {
+  int n = atomic_load_explicit(&g_nqueues, memory_order_acquire);
+  for (int i = 0; i < n; i++) {
+    offload_job_t *j = steal(g_queues[(self + i) % n]);
+    if (j) return j;
+  }
+  return NULL;
+}
+
+// Only a push onto an empty list writes the eventfd: until the owner has
+// taken the list, the earlier write is still pending.
+static void complete(offload_job_t *j) {
+  offload_queue_t *q = j->home;
+  offload_job_t *head = atomic_load_explicit(&q->done, memory_order_relaxed);
+  do {
+    j->next = head;
+  } while (!atomic_compare_exchange_weak_explicit(&q->done, &head, j, memory_order_release,
+                                                  memory_order_relaxed));
+  if (!head) {
+    uint64_t one = 1;
+    ssize_t w = write(q->efd, &one, sizeof(one));
+    (void)w; // a full counter is still readable
+  }
+}
+
+static void *pool_thread(void *arg) {
+  int self = (int)(intptr_t)arg;
+  while (1) {
+    offload_job_t *j = find_job(self);
+    if (!j) {
+      pthread_mutex_lock(&g_lock);
+      atomic_fetch_add(&g_sleepers, 1);
+      while ((j = find_job(self)) == NULL) pthread_cond_wait(&g_wake, &g_lock);
+      atomic_fetch_sub(&g_sleepers, 1);
+      pthread_mutex_unlock(&g_lock);
+    }
+    j->run(j);
+    complete(j);
+  }
+  return NULL;
+}
+
+offload_job_t *offload_completed(offload_queue_t *q) {
+  // Cleared first: a job finishing after the exchange below writes it again.
+  uint64_t v;
+  ssize_t r = read(q->efd, &v, sizeof(v));
+  (void)r;
+  return atomic_exchange_explicit(&q->done, NULL, memory_order_acquire);
+}
+
+int offload_start(int nthreads) {
+  for (int i = 0; i < nthreads; i++) {
+    pthread_t tid;
+    int err = pthread_create(&tid, NULL, pool_thread, (void *)(intptr_t)i);
+    if (err != 0) {
+      errno = err;
+      return -1;
+    }
+    pthread_detach(tid);
+  }
+  return 0;
+}
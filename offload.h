@@ -0,0 +1,61 @@
+// offload.h
+// Work-stealing pool that takes CPU-heavy jobs off the event loops. Each
+// reactor owns one queue: a Chase-Lev deque it pushes jobs onto (bottom) and
+// the pool threads steal from (top), plus a list of finished jobs that comes
+// back to the reactor through an eventfd in its epoll set. A pool thread
+// starts at the queue of its home reactor and moves on to the others only
+// when that one is empty, so one busy reactor gets every idle thread while
+// balanced load stays put. With nothing queued anywhere the threads sleep.
+//
+// Jobs never move between reactors: whatever the job touches stays owned by
+// the reactor that queued it, and is only read back there after completion.
+
+#ifndef OFFLOAD_H
+#define OFFLOAD_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define OFFLOAD_DEQUE_CAP 1024 // jobs a reactor may have queued, power of two
+#define OFFLOAD_MAX_QUEUES 256
+
+struct offload_queue;
+
+typedef struct offload_job {
+  void (*run)(struct offload_job *); // on a pool thread, or on the owner
+  struct offload_queue *home;        // set by offload_submit
+  struct offload_job *next;          // completion list link
+} offload_job_t;
+
+typedef struct offload_queue {
+  _Alignas(64) _Atomic int64_t top;    // advanced by thieves
+  _Alignas(64) _Atomic int64_t bottom; // written by the owner only
+  _Atomic(offload_job_t *) slots[OFFLOAD_DEQUE_CAP];
+  _Alignas(64) _Atomic(offload_job_t *) done; // finished jobs, newest first
+  int efd; // readable while done may be non-empty
+} offload_queue_t;
+
+// Starts nthreads pool threads; the first queue they serve is
+// thread index % number of queues. Returns 0, or -1 with errno set.
+int offload_start(int nthreads);
+
+// Sets up a queue and makes it visible to the pool. Called by the owning
+// thread before its first submit. Returns 0, or -1 with errno set.
+int offload_queue_init(offload_queue_t *q);
+
+// Owner only. Queues j and wakes a pool thread if one is sleeping; -1 when
+// the deque is full (the caller runs the job itself).
+int offload_submit(offload_queue_t *q, offload_job_t *j);
+
+// Owner only: takes back the most recently queued job no thread has started,
+// NULL if there is none. Lets an idle reactor help with its own backlog.
+offload_job_t *offload_take(offload_queue_t *q);
+
+// Whether jobs are queued and not yet started (a hint, racing with thieves).
+int offload_queued(offload_queue_t *q);
+
+// Owner only: clears q->efd and returns the jobs finished since the last
+// call, linked through next, in no particular order.
+offload_job_t *offload_completed(offload_queue_t *q);
+
+#endif
@@ -0,0 +1,98 @@
+// ratelimit.c
+// Per-address connection table, see ratelimit.h.
+//
+// Each slot is one 64-bit word: a 40-bit hash of the address on top, the
+// number of open connections below. A slot whose count is zero is free, so
+// addresses that went away hand their slot back without any delete. Looking
+// up an address scans its whole probe window for its own slot before taking
+// the first free one, and a lost CAS starts the scan over, so two accepts
+// racing for a new address agree on one slot.
+
+#include "ratelimit.h"
+
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IPCAP_SLOTS (1 << 16)
+#define IPCAP_PROBES 32
+#define COUNT_BITS 24
+#define COUNT_MASK ((1ULL << COUNT_BITS) - 1)
+
+static _Atomic uint64_t *g_table;
+static uint64_t g_max;
+
+static uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// 0 for anything that is not an IP peer.
+static uint64_t addr_hash(const struct sockaddr_storage *ss) {
+  if (ss->ss_family == AF_INET) {
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)ss;
+    return mix64(((uint64_t)AF_INET << 32) | sin->sin_addr.s_addr);
+  }
+  if (ss->ss_family == AF_INET6) {
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)ss;
+    const unsigned char *a = sin6->sin6_addr.s6_addr;
+    if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+      uint32_t v4;
+      memcpy(&v4, a + 12, 4);
+      return mix64(((uint64_t)AF_INET << 32) | v4);
+    }
+    uint64_t prefix;
+    memcpy(&prefix, a, 8);
+    return mix64(prefix ^ ((uint64_t)AF_INET6 << 56));
+  }
+  return 0;
+}
+
+int ipcap_init(long max_per_ip) {
+  if (max_per_ip <= 0 || (uint64_t)max_per_ip >= COUNT_MASK) return -1;
+  g_table = (_Atomic uint64_t *)calloc(IPCAP_SLOTS, sizeof(*g_table));
+  if (!g_table) return -1;
+  g_max = (uint64_t)max_per_ip;
+  return 0;
+}
+
+int ipcap_acquire(const struct sockaddr_storage *addr) {
+  uint64_t h = addr_hash(addr);
+  if (!g_table || h == 0) return IPCAP_UNTRACKED;
+  uint64_t key = h & ~COUNT_MASK;
+
+  while (1) {
+    int mine = -1, free_slot = -1;
+    uint64_t w = 0;
+    for (int p = 0; p < IPCAP_PROBES; p++) {
+      int i = (int)((h + (uint64_t)p) & (IPCAP_SLOTS - 1));
+      uint64_t v = atomic_load_explicit(&g_table[i], memory_order_relaxed);
+      if ((v & COUNT_MASK) == 0) {
+        if (free_slot < 0) free_slot = i;
+      } else if ((v & ~COUNT_MASK) == key) {
+        mine = i;
+        w = v;
+        break;
+      }
+    }
+    if (mine >= 0) {
+      if ((w & COUNT_MASK) >= g_max) return IPCAP_REFUSED;
+      if (atomic_compare_exchange_weak(&g_table[mine], &w, w + 1)) return mine;
+      continue;
+    }
+    if (free_slot < 0) return IPCAP_UNTRACKED; // window full: fail open
+    uint64_t v = atomic_load_explicit(&g_table[free_slot], memory_order_relaxed);
+    if ((v & COUNT_MASK) == 0 && atomic_compare_exchange_weak(&g_table[free_slot], &v, key | 1)) {
+      return free_slot;
+    }
+  }
+}
+
+void ipcap_release(int slot) {
+  if (slot >= 0) atomic_fetch_sub(&g_table[slot], 1);
+}
@@ -0,0 +1,64 @@
+// ratelimit.h
+// Admission and fairness limits for the event loops: token buckets a
+// connection draws on for every read, and a table of open connections per
+// source address shared by all reactors. Buckets are owned by one reactor
+// and need no atomics; the table is lock-free, one CAS per accept and one
+// atomic decrement per close.
+
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Tokens are kept in millionths so refills stay exact at any rate: a bucket
+// gains rate units per second, i.e. rate millionths per microsecond, and
+// holds at most one second's worth.
+#define BUCKET_SCALE 1000000LL
+
+typedef struct {
+  int64_t level;    // millionths of a token; negative while in debt
+  uint64_t last_us; // time of the last refill
+} bucket_t;
+
+static inline void bucket_init(bucket_t *b, uint64_t rate, uint64_t now_us) {
+  b->level = (int64_t)rate * BUCKET_SCALE;
+  b->last_us = now_us;
+}
+
+// Tops b up for the time since the last refill; returns whole tokens held.
+static inline int64_t bucket_refill(bucket_t *b, uint64_t rate, uint64_t now_us) {
+  int64_t cap = (int64_t)rate * BUCKET_SCALE;
+  uint64_t dt = now_us - b->last_us;
+  uint64_t full = (uint64_t)(cap - b->level) / rate + 1; // beyond that it only overflows
+  if (dt > full) dt = full;
+  b->last_us = now_us;
+  b->level += (int64_t)rate * (int64_t)dt;
+  if (b->level > cap) b->level = cap;
+  return b->level / BUCKET_SCALE;
+}
+
+// Takes n tokens, going into debt if needed: a read is charged what it got.
+static inline void bucket_take(bucket_t *b, uint64_t n) {
+  b->level -= (int64_t)n * BUCKET_SCALE;
+}
+
+// Microseconds until b holds a whole token again.
+static inline uint64_t bucket_wait_us(const bucket_t *b, uint64_t rate) {
+  int64_t missing = BUCKET_SCALE - b->level;
+  return missing <= 0 ? 0 : (uint64_t)missing / rate + 1;
+}
+
+#define IPCAP_UNTRACKED (-1) // no IP address, or no room in the table: not limited
+#define IPCAP_REFUSED (-2)
+
+// Sizes the table for the given cap, which must fit 24 bits. Returns 0 or -1.
+int ipcap_init(long max_per_ip);
+
+// Counts a new connection from addr. Returns a slot for ipcap_release,
+// IPCAP_UNTRACKED, or IPCAP_REFUSED when addr already has max_per_ip open.
+// IPv6 peers are counted per /64, IPv4-mapped ones as IPv4.
+int ipcap_acquire(const struct sockaddr_storage *addr);
+void ipcap_release(int slot);
+
+#endif
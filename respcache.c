@@ -0,0 +1,214 @@
+// respcache.c
+// Response cache, see respcache.h.
+//
+// Entry metadata, the index and the key/response bytes sit in one mapping on
+// the reactor's node. The index is linear probing over at least twice as
+// many slots as entries, each holding an entry number plus one (0 is empty);
+// an eviction removes its slot by shifting the rest of its cluster back, so
+// lookups never wade through tombstones.
+
+#include "respcache.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+
+#include "topology.h"
+
+typedef struct {
+  uint64_t hash;
+  uint32_t key_len;
+  uint32_t resp_len;
+  unsigned char ref;  // hit since the hand last passed
+  unsigned char live; // reachable through the index
+} entry_t;
+
+struct respcache {
+  entry_t *entries;
+  size_t nentries;
+  size_t used;     // entries handed out so far, up to nentries
+  size_t hand;     // CLOCK position
+  size_t reserved; // entry waiting for respcache_commit
+  uint32_t *index;
+  size_t mask;
+  unsigned char *store; // per entry: max_key key bytes, then max_resp response bytes
+  size_t max_key;
+  size_t max_resp;
+};
+
+// ---- hashing ----
+// wyhash's mixing (final version 4 constants): 128-bit multiplies folded to
+// 64 bits, reading the input 16 or 48 bytes at a time.
+
+static const uint64_t WY0 = 0xa0761d6478bd642fULL, WY1 = 0xe7037ed1a0b428dbULL,
+                      WY2 = 0x8ebc6af09c88c6e3ULL, WY3 = 0x589965cc75374cc3ULL;
+
+static uint64_t g_seed;
+static pthread_once_t g_seed_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t wy_r8(const unsigned char *p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static inline uint64_t wy_r4(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+uint64_t respcache_hash(const void *key, size_t len) {
+  const unsigned char *p = (const unsigned char *)key;
+  uint64_t seed = g_seed ^ wy_mix(g_seed ^ WY0, WY1);
+  uint64_t a, b;
+  if (len <= 16) {
+    if (len >= 4) {
+      size_t mid = (len >> 3) << 2;
+      a = (wy_r4(p) << 32) | wy_r4(p + mid);
+      b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - mid);
+    } else if (len > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      uint64_t s1 = seed, s2 = seed;
+      do {
+        seed = wy_mix(wy_r8(p) ^ WY1, wy_r8(p + 8) ^ seed);
+        s1 = wy_mix(wy_r8(p + 16) ^ WY2, wy_r8(p + 24) ^ s1);
+        s2 = wy_mix(wy_r8(p + 32) ^ WY3, wy_r8(p + 40) ^ s2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= s1 ^ s2;
+    }
+    while (i > 16) {
+      seed = wy_mix(wy_r8(p) ^ WY1, wy_r8(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = wy_r8(p + i - 16);
+    b = wy_r8(p + i - 8);
+  }
+  __uint128_t r = (__uint128_t)(a ^ WY1) * (b ^ seed);
+  return wy_mix((uint64_t)r ^ WY0 ^ len, (uint64_t)(r >> 64) ^ WY1);
+}
+
+// A seed nobody outside knows keeps clients from lining up collisions; a
+// collision only costs a longer probe, every hit is compared in full.
+static void seed_init(void) {
+  if (getrandom(&g_seed, sizeof(g_seed), GRND_NONBLOCK) != (ssize_t)sizeof(g_seed)) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    g_seed = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+  }
+}
+
+// ---- table ----
+
+static size_t align_up(size_t n) {
+  return (n + 63) & ~(size_t)63;
+}
+
+respcache_t *respcache_create(size_t entries, size_t max_key, size_t max_resp, int node) {
+  pthread_once(&g_seed_once, seed_init);
+  if (entries == 0 || entries > UINT32_MAX / 2) return NULL;
+  size_t slots = 1;
+  while (slots < entries * 2) slots <<= 1;
+
+  size_t stride = max_key + max_resp;
+  size_t off_entries = align_up(sizeof(respcache_t));
+  size_t off_index = off_entries + align_up(entries * sizeof(entry_t));
+  size_t off_store = off_index + align_up(slots * sizeof(uint32_t));
+  unsigned char *base = (unsigned char *)topo_alloc(off_store + entries * stride, node);
+  if (!base) return NULL;
+
+  respcache_t *c = (respcache_t *)base;
+  c->entries = (entry_t *)(base + off_entries);
+  c->nentries = entries;
+  c->index = (uint32_t *)(base + off_index);
+  c->mask = slots - 1;
+  c->store = base + off_store;
+  c->max_key = max_key;
+  c->max_resp = max_resp;
+  return c; // the rest is zero: no entries used, index empty
+}
+
+static unsigned char *entry_key(const respcache_t *c, size_t e) {
+  return c->store + e * (c->max_key + c->max_resp);
+}
+
+const unsigned char *respcache_get(respcache_t *c, uint64_t h, const void *key, size_t len,
+                                   size_t *resp_len) {
+  for (size_t i = h & c->mask; c->index[i]; i = (i + 1) & c->mask) {
+    size_t e = c->index[i] - 1;
+    entry_t *en = &c->entries[e];
+    if (en->hash == h && en->key_len == len && memcmp(entry_key(c, e), key, len) == 0) {
+      en->ref = 1;
+      *resp_len = en->resp_len;
+      return entry_key(c, e) + c->max_key;
+    }
+  }
+  return NULL;
+}
+
+// Removes entry e's slot, moving later members of the cluster into the gap
+// when their home slot lies at or before it.
+static void index_remove(respcache_t *c, size_t e) {
+  size_t i = c->entries[e].hash & c->mask;
+  while (c->index[i] != e + 1) i = (i + 1) & c->mask;
+
+  for (size_t j = (i + 1) & c->mask; c->index[j]; j = (j + 1) & c->mask) {
+    size_t home = c->entries[c->index[j] - 1].hash & c->mask;
+    // Distance from home to j versus from i to j, both around the ring.
+    if (((j - home) & c->mask) >= ((j - i) & c->mask)) {
+      c->index[i] = c->index[j];
+      i = j;
+    }
+  }
+  c->index[i] = 0;
+  c->entries[e].live = 0;
+}
+
+unsigned char *respcache_reserve(respcache_t *c, uint64_t h, const void *key, size_t len) {
+  size_t e;
+  if (c->used < c->nentries) {
+    e = c->used++;
+  } else {
+    while (c->entries[c->hand].ref) {
+      c->entries[c->hand].ref = 0;
+      c->hand = (c->hand + 1) % c->nentries;
+    }
+    e = c->hand;
+    c->hand = (c->hand + 1) % c->nentries;
+    if (c->entries[e].live) index_remove(c, e);
+  }
+
+  entry_t *en = &c->entries[e];
+  en->hash = h;
+  en->key_len = (uint32_t)len;
+  en->ref = 0;
+  memcpy(entry_key(c, e), key, len);
+  c->reserved = e;
+  return entry_key(c, e) + c->max_key;
+}
+
+void respcache_commit(respcache_t *c, size_t resp_len) {
+  size_t e = c->reserved;
+  entry_t *en = &c->entries[e];
+  en->resp_len = (uint32_t)resp_len;
+  size_t i = en->hash & c->mask;
+  while (c->index[i]) i = (i + 1) & c->mask;
+  c->index[i] = (uint32_t)(e + 1);
+  en->live = 1;
+}
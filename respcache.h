@@ -0,0 +1,38 @@
+// respcache.h
+// Per-reactor cache of finished responses for small payloads (--cache):
+// traffic full of identical messages (health checks, fixed commands) then
+// costs a hash and a copy instead of a transform. Entries are found through
+// an open-addressing index keyed by a wyhash-style hash of the payload,
+// compared in full before a hit, and evicted by CLOCK: a hit sets an entry's
+// reference bit, the hand clears bits until it reaches an entry without one.
+// A payload seen only once gets no bit, so it is the first to go.
+//
+// Owned by one reactor thread; nothing here is shared or atomic.
+
+#ifndef RESPCACHE_H
+#define RESPCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct respcache respcache_t;
+
+// entries responses of up to max_resp bytes, for payloads of up to max_key
+// bytes, in memory bound to NUMA node (-1 for none). NULL on failure.
+respcache_t *respcache_create(size_t entries, size_t max_key, size_t max_resp, int node);
+
+// Hash of a payload for the calls below; seeded per process.
+uint64_t respcache_hash(const void *key, size_t len);
+
+// The stored response for key and its length, or NULL on a miss.
+const unsigned char *respcache_get(respcache_t *c, uint64_t h, const void *key, size_t len,
+                                   size_t *resp_len);
+
+// After a miss: takes an entry for key, evicting one if the cache is full,
+// and returns its max_resp-byte response buffer. The entry is not found by
+// respcache_get until respcache_commit says how much of the buffer is the
+// response; nothing else may be called in between.
+unsigned char *respcache_reserve(respcache_t *c, uint64_t h, const void *key, size_t len);
+void respcache_commit(respcache_t *c, size_t resp_len);
+
+#endif
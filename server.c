@@ -1,174 +1,3519 @@
-// server.c
-// Threaded TCP Echo Server (lowercase -> UPPERCASE) with mutex-protected connected-clients counter
-// Loopback only: 127.0.0.1
-// Buffer size: 4096
-// Uses system calls (socket/bind/listen/accept/recv/send/close) + pthread + mutex
-
-#define _POSIX_C_SOURCE 200809L
-#include <arpa/inet.h>
-#include <ctype.h>
-#include <errno.h>
-#include <netinet/in.h>
-#include <pthread.h>
-#include <signal.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <sys/socket.h>
-#include <unistd.h>
-
-#define BUF_SIZE 4096
-#define DEFAULT_PORT 5555
-#define BACKLOG 64
-
-static pthread_mutex_t g_clients_mtx = PTHREAD_MUTEX_INITIALIZER;
-static int g_connected_clients = 0;
-
-static void die(const char *msg) {
-  perror(msg);
-  exit(EXIT_FAILURE);
-}
-
-static ssize_t send_all(int fd, const void *buf, size_t len) {
-  const unsigned char *p = (const unsigned char *)buf;
-  size_t total = 0;
-
-  while (total < len) {
-    ssize_t n = send(fd, p + total, len - total, 0);
-    if (n < 0) {
-      if (errno == EINTR) continue; 
-    }
-    if (n == 0) break; 
-    total += (size_t)n;
-  }
-  return (ssize_t)total;
-}
-
-static void to_uppercase(unsigned char *buf, size_t n) {
-  for (size_t i = 0; i < n; i++) {
-    buf[i] = (unsigned char)toupper((unsigned char)buf[i]);
-  }
-}
-
-typedef struct {
-  int client_fd;
-  struct sockaddr_in client_addr;
-} client_ctx_t;
-
-static void inc_clients(void) {
-  pthread_mutex_lock(&g_clients_mtx);
-  g_connected_clients++;
-  int now = g_connected_clients;
-  pthread_mutex_unlock(&g_clients_mtx);
-
-  fprintf(stderr, "[server] connected clients = %d\n", now);
-}
-
-static void dec_clients(void) {
-  pthread_mutex_lock(&g_clients_mtx);
-  g_connected_clients--;
-  int now = g_connected_clients;
-  pthread_mutex_unlock(&g_clients_mtx);
-
-  fprintf(stderr, "[server] connected clients = %d\n", now);
-}
-
-static void *client_thread(void *arg) {
-  client_ctx_t *ctx = (client_ctx_t *)arg;
-  int fd = ctx->client_fd;
-
-  free(ctx);
-
-  inc_clients();
-
-  unsigned char buf[BUF_SIZE];
-
-  while (1) {
-    ssize_t r = recv(fd, buf, sizeof(buf), 0);
-    if (r < 0) {
-      if (errno == EINTR) continue; 
-      perror("[server] recv");
-      break;
-    }
-    if (r == 0) {
-      break;
-    }
-
-    to_uppercase(buf, (size_t)r);
-
-    if (send_all(fd, buf, (size_t)r) < 0) {
-      perror("[server] send");
-      break;
-    }
-  }
-
-  close(fd);
-  dec_clients();
-  return NULL;
-}
-
-int main(int argc, char **argv) {
-  signal(SIGPIPE, SIG_IGN);
-
-  int port = DEFAULT_PORT;
-  if (argc >= 2) {
-    port = atoi(argv[1]);
-    if (port <= 0 || port > 65535) {
-      fprintf(stderr, "Usage: %s [port]\n", argv[0]);
-      return EXIT_FAILURE;
-    }
-  }
-
-  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-  if (listen_fd < 0) die("socket");
-
-  int opt = 1;
-  if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
-    die("setsockopt(SO_REUSEADDR)");
-  }
-
-  struct sockaddr_in addr;
-  memset(&addr, 0, sizeof(addr));
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons((uint16_t)port);
-  addr.sin_addr.s_addr = inet_addr("127.0.0.1");
-
-  if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) die("bind");
-
-  if (listen(listen_fd, BACKLOG) < 0) die("listen");
-
-  fprintf(stderr, "[server] listening on 127.0.0.1:%d\n", port);
-
-  while (1) {
-    struct sockaddr_in caddr;
-    socklen_t clen = sizeof(caddr);
-    int client_fd = accept(listen_fd, (struct sockaddr *)&caddr, &clen);
-    if (client_fd < 0) {
-      if (errno == EINTR) continue;
-      perror("accept");
-      continue; // keep server alive
-    }
-
-    client_ctx_t *ctx = (client_ctx_t *)malloc(sizeof(client_ctx_t));
-    if (!ctx) {
-      fprintf(stderr, "[server] malloc failed\n");
-      close(client_fd);
-      continue;
-    }
-    ctx->client_fd = client_fd;
-    ctx->client_addr = caddr;
-
-    pthread_t tid;
-    if (pthread_create(&tid, NULL, client_thread, ctx) != 0) {
-      perror("[server] pthread_create");
-      close(client_fd);
-      free(ctx);
-      continue;
-    }
-
-    pthread_detach(tid);
-  }
-
-  close(listen_fd);
-  return 0;
-}
+// server.c
+// TCP (and optionally UDP) echo server, lowercase -> UPPERCASE by default
+// The per-message transform is a configurable chain (--transform), upper by default,
+// which a --listen or --shm address can replace with its own ,transform=SPEC;
+// a pure echo chain can run zero-copy through splice() (--zero-copy)
+// --framed switches TCP to length-prefixed messages (frame.h), so messages
+// keep their boundaries and may be larger than any receive buffer
+// Listens on 127.0.0.1 unless --listen gives other addresses: IPv4, IPv6 and
+// Unix domain sockets (netaddr.h), any number of them, all served by one engine
+// Receive buffers adapt per connection between 1 KB and 1 MB (rx_adapt), 4 KB to start
+// Engines: thread-per-connection (default), a fixed worker pool fed through a
+// lock-free MPMC ring, or N reactors (edge-triggered epoll, or io_uring when
+// built with IOURING=1), each with its own SO_REUSEPORT listener. Reactors own
+// their memory pools and a timer wheel; --offload, rate limits and --cache
+// are epoll-reactor features
+// Counters are relaxed atomics in per-thread shards; no lock on the data path
+// --tls-cert/--tls-key (built with TLS=1) terminate TLS 1.3: OpenSSL does the
+// handshake and kernel TLS the records, so every engine keeps its data path
+// --shm=unix:ADDR adds same-host sessions over shared-memory rings (shmring.h)
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "frame.h"
+#include "ktls.h"
+#include "metrics.h"
+#include "netaddr.h"
+#include "offload.h"
+#include "ratelimit.h"
+#include "respcache.h"
+#include "shmring.h"
+#include "sockopt.h"
+#include "timerwheel.h"
+#include "topology.h"
+#include "trace.h"
+#include "transform.h"
+
+#define BUF_SIZE 4096  // initial receive buffer, see rx_adapt()
+#define DEFAULT_PORT 5555
+#define MAX_EVENTS 256
+#define MAX_REACTORS 256
+#define MAX_LISTENERS 16
+#define DEFAULT_WORKERS 16
+#define DEFAULT_QUEUE 1024
+#define CACHE_LINE 64
+#define SPLICE_PIPE_SIZE (256 * 1024)
+#define OUTQ_MAX 16   // chunks coalesced into one writev
+#define OUTQ_CAP 64   // chunks an epoll connection may queue, see --out-hwm
+#define DEFAULT_OUT_HWM (1 << 20)
+#define UDP_BATCH 64  // datagrams per recvmmsg/sendmmsg
+#define RX_CLASSES 6   // receive buffer sizes 1 KB, 4 KB, ... 1 MB
+#define RX_MIN_SHIFT 10
+#define RX_START_CLASS 1 // BUF_SIZE
+#define TIMER_TICK_MS 10 // resolution of the connection timeouts
+
+typedef enum {
+  ENGINE_THREAD,
+  ENGINE_POOL,
+  ENGINE_EPOLL,
+  ENGINE_URING
+} engine_t;
+
+
+// --zero-copy: echo-only connections move bytes socket -> pipe -> socket.
+static int g_zero_copy = 0;
+// --framed: TCP payloads are varint length-prefixed frames, see frame.h.
+static int g_framed = 0;
+// --out-hwm: unsent bytes per epoll connection at which reading pauses.
+static size_t g_out_hwm = DEFAULT_OUT_HWM;
+// --backlog, --nodelay, --rcvbuf, ...: applied to every socket, see sockopt.h.
+static sockopt_cfg_t g_sockopts;
+// --metrics-port: admin endpoint; also turns on the clock reads behind the timing histograms.
+static int g_metrics = 0;
+// --idle-timeout, --read-timeout, --write-timeout in ms, 0 = none. Read and
+// write fall back to the idle timeout when not given.
+static long g_idle_timeout_ms = 0;
+static long g_read_timeout_ms = 0;
+static long g_write_timeout_ms = 0;
+// --listen: addresses accepted on, 127.0.0.1:PORT when none are given.
+static netaddr_t g_listen[MAX_LISTENERS];
+static int g_nlisten = 0;
+// --transform and every distinct ",transform=SPEC" of a --listen or --shm
+// address, each parsed once. g_listen_chain maps a g_listen entry to its chain.
+#define MAX_CHAINS (MAX_LISTENERS + 2)
+static transform_chain_t g_chains[MAX_CHAINS];
+static const char *g_chain_spec[MAX_CHAINS];
+static int g_nchains = 0;
+static int g_listen_chain[MAX_LISTENERS];
+static size_t g_trailer_max = 0; // longest trailer of any chain
+
+static size_t g_shm_ring = SHM_RING_DEFAULT; // --shm-ring, bytes per direction
+
+// --offload: epoll reads of at least this many bytes are transformed on the
+// offload pool instead of the reactor; 0 = everything inline.
+static size_t g_offload_min = 0;
+
+// --rate-bytes, --rate-msgs: per-connection token buckets on the epoll loop,
+// per second, 0 = unlimited. --read-budget: bytes one connection may read
+// per wakeup before the rest of the loop gets its turn. --max-conns-per-ip.
+static uint64_t g_rate_bytes = 0;
+static uint64_t g_rate_msgs = 0;
+static size_t g_read_budget = 0;
+static long g_max_per_ip = 0;
+
+// --cache: payloads of up to this many bytes are answered from the reactor's
+// response cache of --cache-entries entries; 0 = no cache.
+#define CACHE_MAX_PAYLOAD 65536
+static size_t g_cache_max = 0;
+static size_t g_cache_entries = 4096;
+
+// --close-after: a TCP connection is closed by the server once it has
+// answered this many reads (frames with --framed), so under connection churn
+// the server holds the TIME_WAIT and the client's ports are free at once;
+// 0 = the client decides. After its FIN the server waits up to --idle-timeout,
+// or CLOSE_DRAIN_MS without one, for the client's.
+#define CLOSE_DRAIN_MS 1000
+static uint64_t g_close_after = 0;
+
+// Set by --tls-cert/--tls-key: every TCP connection starts with a handshake.
+static int g_tls = 0;
+
+static void die(const char *msg) {
+  perror(msg);
+  exit(EXIT_FAILURE);
+}
+
+// A refused option is reported once per kind of socket: the first accepted
+// connection speaks for all the others.
+static void tune_socket(int fd, sock_role_t role) {
+  static atomic_int warned[ROLE_DGRAM + 1];
+  const char *bad = sockopt_apply(fd, &g_sockopts, role);
+  if (bad && !atomic_exchange(&warned[role], 1)) {
+    fprintf(stderr, "[server] setsockopt(%s): %s\n", bad, strerror(errno));
+  }
+}
+
+// ---- stats ----
+// Each thread bumps counters in its own cache-line aligned shard with relaxed
+// atomics; nothing on the hot path takes a lock or writes to stderr. Readers
+// sum all shards. Threads beyond STATS_SHARDS (thread-per-connection mode)
+// share shards round-robin, which is still correct since updates are atomic.
+// Histograms live in the same shards but are only fed while --metrics-port
+// is set, since most of them need a clock read per sample.
+
+#define STATS_SHARDS 64
+
+enum {
+  STAT_OPENED,
+  STAT_CLOSED,
+  STAT_BYTES_IN,
+  STAT_BYTES_OUT,
+  STAT_MSGS,
+  STAT_ERRORS,
+  STAT_SHED,     // connections accepted and dropped at the descriptor limit
+  STAT_EAGAIN_RECV,
+  STAT_EAGAIN_SEND,
+  STAT_TIMEOUTS, // connections closed by --idle/--read/--write-timeout
+  STAT_OFFLOADED, // messages queued for the offload pool
+  STAT_RECLAIMED, // ... and taken back by their idle reactor
+  STAT_THROTTLED, // reads put off by --rate-bytes/--rate-msgs
+  STAT_YIELDS,    // connections sent to the back of the loop by --read-budget
+  STAT_REFUSED,   // connections refused by --max-conns-per-ip
+  STAT_CACHE_HITS,   // messages answered from the response cache
+  STAT_CACHE_MISSES, // ... and small enough for it, but transformed
+  STAT_RESETS,       // connections the peer ended with an RST
+  STAT_DISCARDED,    // reads (frames) that arrived after --close-after
+  STAT_COUNT
+};
+
+enum {
+  HIST_TRANSFORM_NS, // per message, or per parser run with --framed
+  HIST_OUTQ_BYTES,   // unsent bytes when an epoll connection starts a flush
+  HIST_COUNT
+};
+
+typedef struct {
+  _Alignas(CACHE_LINE) _Atomic uint64_t v[STAT_COUNT];
+  hist_t h[HIST_COUNT];
+} stats_shard_t;
+
+static stats_shard_t g_stats[STATS_SHARDS];
+static _Atomic unsigned g_stats_next;
+static __thread stats_shard_t *t_stats;
+
+static inline stats_shard_t *stats_shard(void) {
+  if (!t_stats) t_stats = &g_stats[atomic_fetch_add(&g_stats_next, 1) % STATS_SHARDS];
+  return t_stats;
+}
+
+static inline void stat_add(int which, uint64_t n) {
+  atomic_fetch_add_explicit(&stats_shard()->v[which], n, memory_order_relaxed);
+}
+
+static inline void hist_add(int which, uint64_t v) {
+  hist_observe(&stats_shard()->h[which], v);
+}
+
+static inline uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Jiffy resolution, but no more than a memory read: good enough for buckets.
+static inline uint64_t coarse_now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+// transform_apply, timed into HIST_TRANSFORM_NS while metrics are on.
+static size_t apply_chain(const transform_chain_t *chain, unsigned char *buf, size_t len) {
+  TRACE(TR_XFORM_BEGIN, -1, len);
+  size_t n;
+  if (!g_metrics) {
+    n = transform_apply(chain, buf, len);
+  } else {
+    uint64_t t0 = now_ns();
+    n = transform_apply(chain, buf, len);
+    hist_add(HIST_TRANSFORM_NS, now_ns() - t0);
+  }
+  TRACE(TR_XFORM_END, -1, n);
+  return n;
+}
+
+// frame_run, timed the same way.
+static int run_frames(frame_parser_t *p, const transform_chain_t *chain, const unsigned char *in,
+                      size_t n, size_t *used, unsigned char *out, size_t cap, size_t *wrote) {
+  TRACE(TR_XFORM_BEGIN, -1, n);
+  int rc;
+  if (!g_metrics) {
+    rc = frame_run(p, chain, in, n, used, out, cap, wrote);
+  } else {
+    uint64_t t0 = now_ns();
+    rc = frame_run(p, chain, in, n, used, out, cap, wrote);
+    hist_add(HIST_TRANSFORM_NS, now_ns() - t0);
+  }
+  TRACE(TR_XFORM_END, -1, *wrote);
+  return rc;
+}
+
+static void stats_sum(uint64_t out[STAT_COUNT]) {
+  memset(out, 0, sizeof(uint64_t) * STAT_COUNT);
+  for (int i = 0; i < STATS_SHARDS; i++) {
+    for (int k = 0; k < STAT_COUNT; k++) {
+      out[k] += atomic_load_explicit(&g_stats[i].v[k], memory_order_relaxed);
+    }
+  }
+}
+
+static void inc_clients(void) {
+  stat_add(STAT_OPENED, 1);
+}
+
+static void dec_clients(void) {
+  stat_add(STAT_CLOSED, 1);
+}
+
+// Prints one summary line per interval, and only when something changed.
+static void *stats_thread(void *arg) {
+  long interval_ms = (long)(intptr_t)arg;
+  uint64_t prev[STAT_COUNT] = {0};
+  struct timespec ts = {interval_ms / 1000, (interval_ms % 1000) * 1000000L};
+  double sec = (double)interval_ms / 1000.0;
+
+  while (1) {
+    nanosleep(&ts, NULL);
+
+    uint64_t now[STAT_COUNT];
+    stats_sum(now);
+    if (memcmp(now, prev, sizeof(now)) == 0) continue;
+
+    fprintf(stderr,
+            "[server] clients=%llu conns/s=%.0f msgs/s=%.0f in=%.2fMB/s out=%.2fMB/s errors=%llu "
+            "shed=%llu timeouts=%llu\n",
+            (unsigned long long)(now[STAT_OPENED] - now[STAT_CLOSED]),
+            (double)(now[STAT_OPENED] - prev[STAT_OPENED]) / sec,
+            (double)(now[STAT_MSGS] - prev[STAT_MSGS]) / sec,
+            (double)(now[STAT_BYTES_IN] - prev[STAT_BYTES_IN]) / sec / 1e6,
+            (double)(now[STAT_BYTES_OUT] - prev[STAT_BYTES_OUT]) / sec / 1e6,
+            (unsigned long long)now[STAT_ERRORS], (unsigned long long)now[STAT_SHED],
+            (unsigned long long)now[STAT_TIMEOUTS]);
+    memcpy(prev, now, sizeof(prev));
+  }
+  return NULL;
+}
+
+// ---- blocking timeouts ----
+// The blocking engines have no loop to run a timer wheel, so the kernel keeps
+// time: SO_RCVTIMEO ends a recv that waited longer than --idle-timeout, and
+// with --write-timeout sends go out MSG_DONTWAIT and a full socket is waited
+// on in poll() with that timeout. Either way the connection is closed and
+// counted in STAT_TIMEOUTS, not as an error.
+
+static void set_timeout_opt(int fd, int opt, long ms) {
+  struct timeval tv = {ms / 1000, (ms % 1000) * 1000};
+  setsockopt(fd, SOL_SOCKET, opt, &tv, sizeof(tv));
+}
+
+static void set_blocking_timeouts(int fd) {
+  if (g_idle_timeout_ms) set_timeout_opt(fd, SO_RCVTIMEO, g_idle_timeout_ms);
+}
+
+// recv/splice on a blocking socket only fails with EAGAIN once SO_RCVTIMEO runs out.
+static int timed_out(void) {
+  if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ETIMEDOUT) return 0;
+  stat_add(STAT_TIMEOUTS, 1);
+  return 1;
+}
+
+// Under kernel TLS a record that is not application data, in practice the
+// client's close_notify, fails recv with EIO: the end of the stream.
+static int tls_alert(void) {
+  return g_tls && errno == EIO;
+}
+
+// A client may end a connection with an RST (an SO_LINGER 0 close) instead
+// of a FIN; that is its way of hanging up, not a failure.
+static int peer_reset(void) {
+  if (errno != ECONNRESET) return 0;
+  stat_add(STAT_RESETS, 1);
+  return 1;
+}
+
+// Reports a failed blocking recv or send, unless it just timed out or the
+// peer reset it.
+static void io_failed(const char *what) {
+  if (timed_out() || tls_alert() || peer_reset()) return;
+  perror(what);
+  stat_add(STAT_ERRORS, 1);
+}
+
+// ---- server-side close ----
+// A socket closed with unread input goes out as an RST, which would also
+// throw away replies the client has not read yet. So once --close-after is
+// reached the server sends its FIN with shutdown() and reads, unanswered,
+// until the client's FIN; only then does close() leave a TIME_WAIT here.
+
+static long drain_ms(void) {
+  return g_idle_timeout_ms ? g_idle_timeout_ms : CLOSE_DRAIN_MS;
+}
+
+// Counts input that arrived after --close-after: per read, or per whole
+// frame with --framed (fp then tracks frames across calls).
+static void count_discarded(frame_parser_t *fp, const unsigned char *in, size_t n) {
+  uint64_t frames = 1;
+  if (n == 0) return;
+  if (fp) frame_skip(fp, in, n, &frames); // past a malformed header nothing counts
+  stat_add(STAT_DISCARDED, frames);
+}
+
+// The blocking engines' version: left is input already read but not answered.
+static void linger_close(int fd, frame_parser_t *fp, const unsigned char *left, size_t n) {
+  count_discarded(fp, left, n);
+  if (shutdown(fd, SHUT_WR) < 0) return;
+  set_timeout_opt(fd, SO_RCVTIMEO, drain_ms());
+  unsigned char buf[4096];
+  while (1) {
+    ssize_t r = recv(fd, buf, sizeof(buf), 0);
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0) {
+      if (!timed_out()) peer_reset();
+      return;
+    }
+    if (r == 0) return;
+    count_discarded(fp, buf, (size_t)r);
+  }
+}
+
+// Sleeps in poll() rather than spinning if a non-blocking socket fills up.
+// Fails with ETIMEDOUT after --write-timeout without room.
+static int wait_writable(int fd) {
+  struct pollfd pfd = {fd, POLLOUT, 0};
+  int rc;
+  while ((rc = poll(&pfd, 1, g_write_timeout_ms ? (int)g_write_timeout_ms : -1)) < 0) {
+    if (errno != EINTR) return -1;
+  }
+  if (rc == 0) {
+    errno = ETIMEDOUT;
+    return -1;
+  }
+  return 0;
+}
+
+static int send_flags(void) {
+  return MSG_NOSIGNAL | (g_write_timeout_ms ? MSG_DONTWAIT : 0);
+}
+
+// Returns len, or -1 with errno set; a partial send never looks like success.
+static ssize_t send_all(int fd, const void *buf, size_t len) {
+  const unsigned char *p = (const unsigned char *)buf;
+  size_t total = 0;
+
+  while (total < len) {
+    ssize_t n = send(fd, p + total, len - total, send_flags());
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        stat_add(STAT_EAGAIN_SEND, 1);
+        TRACE(TR_EAGAIN, fd, 1);
+        if (wait_writable(fd) == 0) continue;
+      }
+      return -1;
+    }
+    total += (size_t)n;
+  }
+  return (ssize_t)total;
+}
+
+typedef struct {
+  int client_fd;
+  struct sockaddr_storage client_addr;
+  const transform_chain_t *chain; // from the listener that accepted it
+} client_ctx_t;
+
+// Like send_all, for a scatter list. iov is consumed (modified) as it goes.
+static ssize_t writev_all(int fd, struct iovec *iov, int cnt) {
+  size_t total = 0;
+
+  while (cnt > 0) {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (size_t)cnt;
+    ssize_t n = sendmsg(fd, &msg, send_flags());
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        stat_add(STAT_EAGAIN_SEND, 1);
+        TRACE(TR_EAGAIN, fd, 1);
+        if (wait_writable(fd) == 0) continue;
+      }
+      return -1;
+    }
+    total += (size_t)n;
+
+    size_t left = (size_t)n;
+    while (cnt > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (unsigned char *)iov->iov_base + left;
+      iov->iov_len -= left;
+    }
+  }
+  return (ssize_t)total;
+}
+
+// An echo chain leaves framed traffic byte-for-byte unchanged (no trailer
+// means every response header equals its request header), so splice still applies.
+static int use_splice(const transform_chain_t *chain) {
+  return g_zero_copy && chain->nstages == 0;
+}
+
+// Returns a pipe sized for bulk splicing, or -1 with errno set.
+static int open_splice_pipe(int p[2]) {
+  if (pipe2(p, O_CLOEXEC) < 0) return -1;
+  fcntl(p[0], F_SETPIPE_SZ, SPLICE_PIPE_SIZE); // best effort, default is 64 KB
+  return 0;
+}
+
+// Blocking zero-copy echo: the payload never enters user space.
+static void serve_client_splice(int fd) {
+  int p[2];
+  if (open_splice_pipe(p) < 0) {
+    perror("[server] pipe2");
+    return;
+  }
+  // A blocking splice into the socket cannot poll, so it gets SO_SNDTIMEO.
+  if (g_write_timeout_ms) set_timeout_opt(fd, SO_SNDTIMEO, g_write_timeout_ms);
+
+  uint64_t msgs = 0;
+  while (1) {
+    ssize_t r = splice(fd, NULL, p[1], NULL, SPLICE_PIPE_SIZE, SPLICE_F_MOVE);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      io_failed("[server] splice(in)");
+      break;
+    }
+    if (r == 0) break;
+    stat_add(STAT_BYTES_IN, (uint64_t)r);
+    stat_add(STAT_MSGS, 1);
+    TRACE(TR_READ, fd, r);
+    msgs++;
+
+    ssize_t left = r;
+    while (left > 0) {
+      ssize_t w = splice(p[0], NULL, fd, NULL, (size_t)left, SPLICE_F_MOVE);
+      if (w < 0) {
+        if (errno == EINTR) continue;
+        break;
+      }
+      left -= w;
+    }
+    stat_add(STAT_BYTES_OUT, (uint64_t)(r - left));
+    TRACE(TR_SEND, fd, r - left);
+    if (left > 0) {
+      io_failed("[server] splice(out)");
+      break;
+    }
+    if (g_close_after && msgs >= g_close_after) {
+      linger_close(fd, NULL, NULL, 0);
+      break;
+    }
+  }
+
+  close(p[0]);
+  close(p[1]);
+}
+
+// ---- adaptive receive buffers ----
+// Each connection reads into a buffer of one of RX_CLASSES sizes, each 4x
+// the last. A read that fills the buffer means a bulk sender with more
+// queued, so the next read gets the next class up (fewer syscalls per GB); a
+// read using under 1/16 of it steps back down, which cannot bounce straight
+// back up since the smaller class is still 4x what arrived.
+
+static size_t rx_class_size(int cls) {
+  return (size_t)1 << (RX_MIN_SHIFT + 2 * cls);
+}
+
+static int rx_adapt(int cls, size_t got, size_t room) {
+  if (got >= room && cls < RX_CLASSES - 1) return cls + 1;
+  if (got <= rx_class_size(cls) / 16 && cls > 0) return cls - 1;
+  return cls;
+}
+
+// Heap buffer for the blocking engines; the contents are not kept across a resize.
+typedef struct {
+  unsigned char *data;
+  size_t cap;
+  int cls;
+} rxbuf_t;
+
+static int rxbuf_resize(rxbuf_t *b, int cls) {
+  if (b->data && cls == b->cls) return 0;
+  unsigned char *p = (unsigned char *)malloc(rx_class_size(cls));
+  if (!p) return b->data ? 0 : -1; // keep the old size if a bigger one is unavailable
+  free(b->data);
+  b->data = p;
+  b->cap = rx_class_size(cls);
+  b->cls = cls;
+  return 0;
+}
+
+// Blocking framed echo: every recv is run through the frame parser and
+// whatever complete or partial response frames it yields go out in one send,
+// so a burst of small frames costs one syscall each way.
+static void serve_client_framed(int fd, const transform_chain_t *chain) {
+  // Output is sized like the input; a reply that does not fit goes out in pieces.
+  rxbuf_t in = {NULL, 0, 0}, out = {NULL, 0, 0};
+  frame_parser_t fp;
+  frame_parser_init(&fp, chain); // trailer size was checked at startup
+  if (rxbuf_resize(&in, RX_START_CLASS) < 0 || rxbuf_resize(&out, RX_START_CLASS) < 0) {
+    fprintf(stderr, "[server] malloc failed\n");
+    goto done;
+  }
+
+  while (1) {
+    ssize_t r = recv(fd, in.data, in.cap, 0);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      io_failed("[server] recv");
+      break;
+    }
+    if (r == 0) break;
+    stat_add(STAT_BYTES_IN, (uint64_t)r);
+    TRACE(TR_READ, fd, r);
+
+    uint64_t frames = fp.frames;
+    size_t off = 0;
+    do {
+      size_t used, wrote, n = (size_t)r - off;
+      if (g_close_after) {
+        // A frame at a time, so that none after the last is answered.
+        int last_done = fp.frames >= g_close_after && !frame_partial(&fp);
+        if (last_done && !frame_pending(&fp)) break;
+        n = last_done ? 0 : frame_one(&fp, in.data + off, n);
+      }
+      if (run_frames(&fp, chain, in.data + off, n, &used, out.data, out.cap, &wrote) < 0) {
+        fprintf(stderr, "[server] malformed frame header, closing connection\n");
+        stat_add(STAT_ERRORS, 1);
+        goto done;
+      }
+      off += used;
+      if (wrote > 0) {
+        if (send_all(fd, out.data, wrote) < 0) {
+          io_failed("[server] send");
+          goto done;
+        }
+        stat_add(STAT_BYTES_OUT, wrote);
+        TRACE(TR_SEND, fd, wrote);
+      }
+    } while (off < (size_t)r || frame_pending(&fp));
+    stat_add(STAT_MSGS, fp.frames - frames);
+    if (g_close_after && fp.frames >= g_close_after && !frame_partial(&fp) &&
+        !frame_pending(&fp)) {
+      linger_close(fd, &fp, in.data + off, (size_t)r - off);
+      break;
+    }
+    int cls = rx_adapt(in.cls, (size_t)r, in.cap);
+    rxbuf_resize(&in, cls);
+    rxbuf_resize(&out, cls);
+  }
+done:
+  free(in.data);
+  free(out.data);
+}
+
+// Blocking recv -> transform -> send loop shared by the thread and pool engines.
+static void serve_client(int fd, const transform_chain_t *chain) {
+  inc_clients();
+  TRACE(TR_ACCEPT, fd, 0);
+  set_blocking_timeouts(fd);
+
+#ifdef HAVE_OPENSSL
+  if (g_tls && ktls_accept(fd, g_read_timeout_ms) < 0) {
+    io_failed("[server] tls handshake");
+    TRACE(TR_CLOSE, fd, 0);
+    close(fd);
+    dec_clients();
+    return;
+  }
+#endif
+
+  if (use_splice(chain)) {
+    serve_client_splice(fd);
+    TRACE(TR_CLOSE, fd, 0);
+    close(fd);
+    dec_clients();
+    return;
+  }
+  if (g_framed) {
+    serve_client_framed(fd, chain);
+    TRACE(TR_CLOSE, fd, 0);
+    close(fd);
+    dec_clients();
+    return;
+  }
+
+  // Block for the first chunk, then pick up whatever else has already
+  // arrived so a burst goes back out in one writev. All chunks of a round
+  // share one adaptively sized buffer.
+  rxbuf_t buf = {NULL, 0, 0};
+  if (rxbuf_resize(&buf, RX_START_CLASS) < 0) {
+    fprintf(stderr, "[server] malloc failed\n");
+    TRACE(TR_CLOSE, fd, 0);
+    close(fd);
+    dec_clients();
+    return;
+  }
+  struct iovec iov[OUTQ_MAX];
+  int done = 0;
+  uint64_t msgs = 0;
+
+  while (!done) {
+    int n = 0;
+    size_t off = 0;
+    // Leave room for whatever the chain appends (e.g. a checksum).
+    while (n < OUTQ_MAX && buf.cap - off > chain->trailer_len) {
+      ssize_t r = recv(fd, buf.data + off, buf.cap - off - chain->trailer_len,
+                       n == 0 ? 0 : MSG_DONTWAIT);
+      if (r < 0) {
+        if (errno == EINTR) continue;
+        if (n > 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        io_failed("[server] recv");
+        done = 1;
+        n = 0; // connection is broken, nothing to echo
+        break;
+      }
+      if (r == 0) {
+        done = 1;
+        break;
+      }
+
+      stat_add(STAT_BYTES_IN, (uint64_t)r);
+      TRACE(TR_READ, fd, r);
+      iov[n].iov_base = buf.data + off;
+      iov[n].iov_len = apply_chain(chain, buf.data + off, (size_t)r);
+      off += iov[n].iov_len;
+      n++;
+    }
+    if (n == 0) break;
+
+    stat_add(STAT_MSGS, (uint64_t)n);
+    ssize_t w = n == 1 ? send_all(fd, buf.data, iov[0].iov_len) : writev_all(fd, iov, n);
+    if (w < 0) {
+      io_failed("[server] send");
+      break;
+    }
+    stat_add(STAT_BYTES_OUT, (uint64_t)w);
+    TRACE(TR_SEND, fd, w);
+    msgs += (uint64_t)n;
+    if (g_close_after && msgs >= g_close_after) {
+      linger_close(fd, NULL, NULL, 0);
+      break;
+    }
+    rxbuf_resize(&buf, rx_adapt(buf.cls, off + chain->trailer_len, buf.cap));
+  }
+
+  free(buf.data);
+  TRACE(TR_CLOSE, fd, 0);
+  close(fd);
+  dec_clients();
+}
+
+static void *client_thread(void *arg) {
+  client_ctx_t *ctx = (client_ctx_t *)arg;
+  int fd = ctx->client_fd;
+  const transform_chain_t *chain = ctx->chain;
+
+  free(ctx);
+
+  serve_client(fd, chain);
+  return NULL;
+}
+
+// SO_REUSEPORT does not apply to Unix domain sockets, so the reactors share
+// one listener for those (EPOLLEXCLUSIVE wakes a single reactor per connection).
+static int listener_shared(const netaddr_t *a) {
+  return netaddr_family(a) == AF_UNIX;
+}
+
+// A socket file left behind by an earlier run would make bind() fail; abstract
+// names vanish with their last socket and need nothing.
+static void unlink_stale_socket(const netaddr_t *a) {
+  const char *path = ((const struct sockaddr_un *)&a->ss)->sun_path;
+  struct stat st;
+  if (path[0] != '\0' && stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+}
+
+// With reuseport set, every reactor binds its own socket to the same address
+// and the kernel spreads incoming connections across them. Listeners are
+// always non-blocking; every engine drains them with accept_batch().
+static int open_listener(const netaddr_t *a, int reuseport) {
+  int family = netaddr_family(a);
+  int listen_fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) die("socket");
+
+  int opt = 1;
+  if (family == AF_UNIX) {
+    unlink_stale_socket(a);
+  } else {
+    if (setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+      die("setsockopt(SO_REUSEADDR)");
+    }
+    if (reuseport &&
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+      die("setsockopt(SO_REUSEPORT)");
+    }
+    // Lets [::]:PORT and 0.0.0.0:PORT be listed side by side.
+    if (family == AF_INET6 &&
+        setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt)) < 0) {
+      die("setsockopt(IPV6_V6ONLY)");
+    }
+  }
+
+  if (bind(listen_fd, netaddr_sa(a), a->len) < 0) {
+    fprintf(stderr, "[server] bind(%s): %s\n", a->text, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  tune_socket(listen_fd, ROLE_LISTENER);
+  if (listen(listen_fd, g_sockopts.backlog) < 0) die("listen");
+
+  return listen_fd;
+}
+
+// "127.0.0.1:5555, unix:/tmp/echo.sock" for the startup message.
+static const char *listen_desc(void) {
+  static char desc[MAX_LISTENERS * (NETADDR_TEXT_MAX + 2)];
+  size_t off = 0;
+  desc[0] = '\0';
+  for (int i = 0; i < g_nlisten; i++) {
+    off += (size_t)snprintf(desc + off, sizeof(desc) - off, "%s%s", i ? ", " : "",
+                            g_listen[i].text);
+  }
+  return desc;
+}
+
+// ---- accepting ----
+// One wakeup drains the accept queue: accept4() until EAGAIN (or a batch is
+// full), with SOCK_CLOEXEC and, for the event loops, SOCK_NONBLOCK so no
+// fcntl follows. At the descriptor limit a pending connection can never be
+// accepted, the listener stays readable and a naive loop spins on EMFILE;
+// instead every accepting thread keeps one spare descriptor, gives it up to
+// accept and immediately close the connection, then takes it back.
+
+#define ACCEPT_BATCH 64
+
+static __thread int t_spare_fd = -1;
+
+static void reserve_fd(void) {
+  if (t_spare_fd < 0) t_spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+// Returns 0 if a connection was dropped, -1 if there was no spare to do it with.
+static int shed_connection(int listen_fd) {
+  stat_add(STAT_SHED, 1);
+  if (t_spare_fd < 0) return -1;
+  close(t_spare_fd);
+  t_spare_fd = -1;
+  int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+  if (fd >= 0) close(fd);
+  reserve_fd();
+  return fd >= 0 ? 0 : -1;
+}
+
+// Accepts up to max connections from a non-blocking listener into fds (and
+// peer addresses into addrs, if non-NULL). Returns how many; fewer than max
+// means the queue is empty or accept failed for a reason retrying won't fix.
+static int accept_batch(int listen_fd, int flags, int *fds, struct sockaddr_storage *addrs,
+                        int max) {
+  int n = 0;
+  while (n < max) {
+    socklen_t len = sizeof(struct sockaddr_storage);
+    int fd = accept4(listen_fd, addrs ? (struct sockaddr *)&addrs[n] : NULL, addrs ? &len : NULL,
+                     flags);
+    if (fd >= 0) {
+      tune_socket(fd, ROLE_ACCEPTED);
+      fds[n++] = fd;
+      continue;
+    }
+    if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+    if (errno == EMFILE || errno == ENFILE) {
+      if (shed_connection(listen_fd) == 0) continue;
+      break;
+    }
+    perror("[server] accept4");
+    stat_add(STAT_ERRORS, 1);
+    break;
+  }
+  return n;
+}
+
+// Blocks until some listener has a connection waiting, then accepts up to
+// max connections from the ready ones. With lis set, lis[k] is the index of
+// the listener fds[k] came from.
+static int accept_ready(struct pollfd *pfds, int nlisten, int *fds,
+                        struct sockaddr_storage *addrs, int *lis, int max) {
+  for (int i = 0; i < nlisten; i++) pfds[i].events = POLLIN;
+  while (poll(pfds, (nfds_t)nlisten, -1) < 0) {
+    if (errno != EINTR) die("poll");
+  }
+
+  int n = 0;
+  for (int i = 0; i < nlisten && n < max; i++) {
+    if (pfds[i].revents & POLLIN) {
+      int got = accept_batch(pfds[i].fd, SOCK_CLOEXEC, fds + n, addrs ? addrs + n : NULL, max - n);
+      for (int k = 0; lis && k < got; k++) lis[n + k] = i;
+      n += got;
+    }
+  }
+  return n;
+}
+
+static void run_threads(struct pollfd *listeners, int nlisten) {
+  int fds[ACCEPT_BATCH], lis[ACCEPT_BATCH];
+  struct sockaddr_storage addrs[ACCEPT_BATCH];
+
+  reserve_fd();
+  while (1) {
+    int n = accept_ready(listeners, nlisten, fds, addrs, lis, ACCEPT_BATCH);
+
+    for (int i = 0; i < n; i++) {
+      client_ctx_t *ctx = (client_ctx_t *)malloc(sizeof(client_ctx_t));
+      if (!ctx) {
+        fprintf(stderr, "[server] malloc failed\n");
+        close(fds[i]);
+        continue;
+      }
+      ctx->client_fd = fds[i];
+      ctx->client_addr = addrs[i];
+      ctx->chain = &g_chains[g_listen_chain[lis[i]]];
+
+      pthread_t tid;
+      if (pthread_create(&tid, NULL, client_thread, ctx) != 0) {
+        perror("[server] pthread_create");
+        close(fds[i]);
+        free(ctx);
+        continue;
+      }
+
+      pthread_detach(tid);
+    }
+  }
+}
+
+// ---- UDP echo ----
+// Each UDP thread owns a SO_REUSEPORT socket and moves up to UDP_BATCH
+// datagrams per recvmmsg/sendmmsg. Datagrams larger than a buffer are
+// truncated (the kernel reports MSG_TRUNC).
+
+typedef struct {
+  int fd;
+  const transform_chain_t *chain;
+} udp_listener_t;
+
+static int open_udp(const netaddr_t *a) {
+  int fd = socket(netaddr_family(a), SOCK_DGRAM, 0);
+  if (fd < 0) die("socket(udp)");
+
+  int opt = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+    die("setsockopt(SO_REUSEPORT)");
+  }
+  if (netaddr_family(a) == AF_INET6 &&
+      setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt)) < 0) {
+    die("setsockopt(IPV6_V6ONLY)");
+  }
+  tune_socket(fd, ROLE_DGRAM);
+
+  if (bind(fd, netaddr_sa(a), a->len) < 0) {
+    fprintf(stderr, "[server] bind(udp %s): %s\n", a->text, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  return fd;
+}
+
+static void *udp_thread(void *arg) {
+  udp_listener_t *u = (udp_listener_t *)arg;
+  size_t cap = BUF_SIZE - u->chain->trailer_len;
+
+  unsigned char *bufs = (unsigned char *)malloc((size_t)UDP_BATCH * BUF_SIZE);
+  if (!bufs) die("malloc(udp)");
+  struct mmsghdr msgs[UDP_BATCH];
+  struct iovec iov[UDP_BATCH];
+  struct sockaddr_storage peers[UDP_BATCH];
+
+  while (1) {
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < UDP_BATCH; i++) {
+      iov[i].iov_base = bufs + (size_t)i * BUF_SIZE;
+      iov[i].iov_len = cap;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = &peers[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+    }
+
+    // MSG_WAITFORONE: block for the first datagram, then take what is queued.
+    int n = recvmmsg(u->fd, msgs, UDP_BATCH, MSG_WAITFORONE, NULL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      perror("[server] recvmmsg");
+      stat_add(STAT_ERRORS, 1);
+      continue;
+    }
+
+    // The same headers go back out; msg_name still holds each sender.
+    stat_add(STAT_MSGS, (uint64_t)n);
+    for (int i = 0; i < n; i++) {
+      stat_add(STAT_BYTES_IN, msgs[i].msg_len);
+      iov[i].iov_len = apply_chain(u->chain, (unsigned char *)iov[i].iov_base, msgs[i].msg_len);
+    }
+
+    int sent = 0;
+    while (sent < n) {
+      int m = sendmmsg(u->fd, msgs + sent, (unsigned)(n - sent), 0);
+      if (m < 0) {
+        if (errno == EINTR) continue;
+        perror("[server] sendmmsg");
+        stat_add(STAT_ERRORS, 1);
+        break;
+      }
+      for (int i = sent; i < sent + m; i++) stat_add(STAT_BYTES_OUT, msgs[i].msg_len);
+      sent += m;
+    }
+  }
+  return NULL;
+}
+
+// nthreads sockets for every IP listen address; Unix sockets get no UDP twin.
+static int start_udp(int nthreads) {
+  int started = 0;
+  for (int i = 0; i < g_nlisten * nthreads; i++) {
+    const netaddr_t *a = &g_listen[i / nthreads];
+    if (netaddr_family(a) == AF_UNIX) continue;
+    udp_listener_t *u = (udp_listener_t *)malloc(sizeof(udp_listener_t));
+    if (!u) die("malloc(udp)");
+    u->fd = open_udp(a);
+    u->chain = &g_chains[g_listen_chain[i / nthreads]];
+    started++;
+
+    pthread_t tid;
+    int err = pthread_create(&tid, NULL, udp_thread, u);
+    if (err != 0) {
+      fprintf(stderr, "[server] pthread_create(udp %d): %s\n", i, strerror(err));
+      exit(EXIT_FAILURE);
+    }
+    pthread_detach(tid);
+  }
+  return started;
+}
+
+// ---- shared-memory sessions ----
+// --shm=unix:ADDR takes same-host clients that want no socket in the data
+// path: each connection on that Unix socket is offered a memfd with a pair
+// of rings (shmring.h) and gets a thread that moves requests through the
+// transform chain into the response ring. Runs next to any engine.
+
+typedef struct {
+  shm_conn_t conn;
+  const transform_chain_t *chain;
+} shm_session_t;
+
+typedef struct {
+  int listen_fd;
+  const transform_chain_t *chain;
+} shm_listener_t;
+
+// The request is copied once, into its response slot, and transformed there.
+static void *shm_session_thread(void *arg) {
+  shm_session_t *s = (shm_session_t *)arg;
+  shm_conn_t *c = &s->conn;
+  const transform_chain_t *chain = s->chain;
+
+  while (1) {
+    size_t len;
+    const unsigned char *req = (const unsigned char *)shm_peek(c, &len);
+    if (!req) {
+      if (shm_wait(c, 0) < 0) break;
+      continue;
+    }
+    size_t room = len + chain->trailer_len;
+    if (room > shm_record_max(&c->out)) {
+      fprintf(stderr, "[server] shm: %zu-byte message does not fit the ring\n", len);
+      stat_add(STAT_ERRORS, 1);
+      break;
+    }
+    unsigned char *out;
+    while (!(out = (unsigned char *)shm_reserve(c, room))) {
+      if (shm_wait(c, room) < 0) goto done;
+    }
+    memcpy(out, req, len);
+    shm_release(c);
+    size_t n = apply_chain(chain, out, len);
+    shm_commit(c, n);
+    stat_add(STAT_BYTES_IN, len);
+    stat_add(STAT_BYTES_OUT, n);
+    stat_add(STAT_MSGS, 1);
+  }
+done:
+  if (c->broken) {
+    fprintf(stderr, "[server] shm: corrupt record header, closing session\n");
+    stat_add(STAT_ERRORS, 1);
+  }
+  shm_close(c);
+  free(s);
+  dec_clients();
+  return NULL;
+}
+
+static void *shm_accept_thread(void *arg) {
+  shm_listener_t *l = (shm_listener_t *)arg;
+  struct pollfd pfd = {l->listen_fd, POLLIN, 0};
+  int fds[ACCEPT_BATCH];
+
+  reserve_fd();
+  while (1) {
+    int n = accept_ready(&pfd, 1, fds, NULL, NULL, ACCEPT_BATCH);
+    for (int i = 0; i < n; i++) {
+      shm_session_t *s = (shm_session_t *)malloc(sizeof(shm_session_t));
+      if (!s) {
+        fprintf(stderr, "[server] malloc failed\n");
+        close(fds[i]);
+        continue;
+      }
+      if (shm_offer(&s->conn, fds[i], g_shm_ring) < 0) {
+        perror("[server] shm session");
+        stat_add(STAT_ERRORS, 1);
+        close(fds[i]);
+        free(s);
+        continue;
+      }
+      s->chain = l->chain;
+      inc_clients();
+
+      pthread_t tid;
+      if (pthread_create(&tid, NULL, shm_session_thread, s) != 0) {
+        perror("[server] pthread_create(shm)");
+        shm_close(&s->conn);
+        free(s);
+        dec_clients();
+        continue;
+      }
+      pthread_detach(tid);
+    }
+  }
+  return NULL;
+}
+
+static void start_shm(const netaddr_t *a, const transform_chain_t *chain) {
+  shm_listener_t *l = (shm_listener_t *)malloc(sizeof(shm_listener_t));
+  if (!l) die("malloc(shm)");
+  l->listen_fd = open_listener(a, 0);
+  l->chain = chain;
+
+  pthread_t tid;
+  if (pthread_create(&tid, NULL, shm_accept_thread, l) != 0) die("pthread_create(shm)");
+  pthread_detach(tid);
+}
+
+// ---- worker pool engine ----
+// The accept loop hands client_ctx_t entries by value to pre-spawned workers
+// through a bounded lock-free MPMC ring (Vyukov's sequence-number design), so
+// a connection costs neither a malloc nor a pthread_create. The semaphores
+// only park idle threads; the ring itself never takes a lock.
+
+typedef enum {
+  BACKPRESSURE_WAIT,   // stop accepting until a worker frees a slot
+  BACKPRESSURE_REJECT  // accept and close immediately while the ring is full
+} backpressure_t;
+
+typedef struct {
+  _Atomic size_t seq;
+  client_ctx_t ctx;
+} mpmc_cell_t;
+
+typedef struct {
+  mpmc_cell_t *cells;
+  size_t mask;
+  _Alignas(CACHE_LINE) _Atomic size_t enq_pos;
+  _Alignas(CACHE_LINE) _Atomic size_t deq_pos;
+  _Alignas(CACHE_LINE) sem_t items; // published entries
+  sem_t space;                      // free slots, BACKPRESSURE_WAIT only
+} mpmc_queue_t;
+
+static void mpmc_init(mpmc_queue_t *q, size_t capacity) {
+  size_t cap = 2;
+  while (cap < capacity) cap <<= 1;
+
+  q->cells = (mpmc_cell_t *)calloc(cap, sizeof(mpmc_cell_t));
+  if (!q->cells) die("calloc(queue)");
+  for (size_t i = 0; i < cap; i++) atomic_init(&q->cells[i].seq, i);
+  q->mask = cap - 1;
+  atomic_init(&q->enq_pos, 0);
+  atomic_init(&q->deq_pos, 0);
+  if (sem_init(&q->items, 0, 0) < 0) die("sem_init");
+  if (sem_init(&q->space, 0, (unsigned)cap) < 0) die("sem_init");
+}
+
+// Returns 0 on success, -1 if the ring is full.
+static int mpmc_push(mpmc_queue_t *q, const client_ctx_t *ctx) {
+  size_t pos = atomic_load_explicit(&q->enq_pos, memory_order_relaxed);
+  while (1) {
+    mpmc_cell_t *cell = &q->cells[pos & q->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&q->enq_pos, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        cell->ctx = *ctx;
+        atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+        return 0;
+      }
+    } else if (diff < 0) {
+      return -1;
+    } else {
+      pos = atomic_load_explicit(&q->enq_pos, memory_order_relaxed);
+    }
+  }
+}
+
+// Returns 0 on success, -1 if nothing is published yet.
+static int mpmc_pop(mpmc_queue_t *q, client_ctx_t *out) {
+  size_t pos = atomic_load_explicit(&q->deq_pos, memory_order_relaxed);
+  while (1) {
+    mpmc_cell_t *cell = &q->cells[pos & q->mask];
+    size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&q->deq_pos, &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        *out = cell->ctx;
+        atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+        return 0;
+      }
+    } else if (diff < 0) {
+      return -1;
+    } else {
+      pos = atomic_load_explicit(&q->deq_pos, memory_order_relaxed);
+    }
+  }
+}
+
+typedef struct {
+  mpmc_queue_t queue;
+  backpressure_t backpressure;
+} pool_t;
+
+static void *pool_worker(void *arg) {
+  pool_t *pool = (pool_t *)arg;
+  client_ctx_t ctx;
+
+  while (1) {
+    if (sem_wait(&pool->queue.items) < 0) {
+      if (errno == EINTR) continue;
+      die("sem_wait");
+    }
+    // The semaphore counts published entries, but an earlier slot may still
+    // be mid-publish by another producer; spin briefly until it lands.
+    while (mpmc_pop(&pool->queue, &ctx) < 0) sched_yield();
+    if (pool->backpressure == BACKPRESSURE_WAIT) sem_post(&pool->queue.space);
+
+    serve_client(ctx.client_fd, ctx.chain);
+  }
+  return NULL;
+}
+
+static void run_pool(struct pollfd *listeners, int nlisten, int nworkers, size_t queue_len,
+                     backpressure_t bp) {
+  static pool_t pool;
+  mpmc_init(&pool.queue, queue_len);
+  pool.backpressure = bp;
+
+  for (int i = 0; i < nworkers; i++) {
+    pthread_t tid;
+    int err = pthread_create(&tid, NULL, pool_worker, &pool);
+    if (err != 0) {
+      fprintf(stderr, "[server] pthread_create(worker %d): %s\n", i, strerror(err));
+      exit(EXIT_FAILURE);
+    }
+    pthread_detach(tid);
+  }
+
+  int fds[ACCEPT_BATCH], lis[ACCEPT_BATCH];
+  struct sockaddr_storage addrs[ACCEPT_BATCH];
+  unsigned long rejected = 0;
+
+  reserve_fd();
+  while (1) {
+    // Delaying accept leaves new connections in the kernel's listen backlog:
+    // the wait policy reserves one queue slot, then takes as many more as are
+    // free without blocking, and accepts at most that many.
+    int slots = ACCEPT_BATCH;
+    if (bp == BACKPRESSURE_WAIT) {
+      if (sem_wait(&pool.queue.space) < 0) {
+        if (errno == EINTR) continue;
+        die("sem_wait");
+      }
+      slots = 1;
+      while (slots < ACCEPT_BATCH && sem_trywait(&pool.queue.space) == 0) slots++;
+    }
+
+    int n = accept_ready(listeners, nlisten, fds, addrs, lis, slots);
+    if (bp == BACKPRESSURE_WAIT) {
+      for (int i = n; i < slots; i++) sem_post(&pool.queue.space);
+    }
+
+    for (int i = 0; i < n; i++) {
+      client_ctx_t ctx;
+      ctx.client_fd = fds[i];
+      ctx.client_addr = addrs[i];
+      ctx.chain = &g_chains[g_listen_chain[lis[i]]];
+
+      if (mpmc_push(&pool.queue, &ctx) < 0) {
+        // Only reachable with BACKPRESSURE_REJECT: the wait policy reserved a slot.
+        close(fds[i]);
+        rejected++;
+        if ((rejected & (rejected - 1)) == 0) {
+          fprintf(stderr, "[server] worker queue full, rejected %lu connection(s)\n", rejected);
+        }
+        continue;
+      }
+      sem_post(&pool.queue.items);
+    }
+  }
+}
+
+// ---- per-reactor memory ----
+// Connection objects and I/O chunks come from fixed-size object pools owned
+// by one reactor thread. Pools grow a slab at a time straight from mmap and
+// never give memory back; closed connections and sent chunks go on a LIFO
+// free list, so steady-state accept/close never touches malloc's locks.
+// Objects are cache-line aligned so neighbours never share a line.
+
+#define SLAB_BYTES (256 * 1024)
+
+typedef struct pool_obj {
+  struct pool_obj *next;
+} pool_obj_t;
+
+typedef struct {
+  const char *name;
+  size_t obj_size;  // rounded up to CACHE_LINE
+  pool_obj_t *free;
+  size_t in_use;
+  size_t capacity;
+  int node;         // NUMA node slabs are bound to, -1 for none
+} objpool_t;
+
+static int objpool_grow(objpool_t *p) {
+  size_t per_slab = SLAB_BYTES / p->obj_size;
+  if (per_slab == 0) per_slab = 1;
+  size_t bytes = per_slab * p->obj_size;
+
+  unsigned char *slab = (unsigned char *)mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (slab == MAP_FAILED) return -1;
+  topo_bind(slab, bytes, p->node); // best effort, so a failure is not fatal
+
+  // Thread the new objects onto the free list in address order.
+  for (size_t i = per_slab; i-- > 0;) {
+    pool_obj_t *o = (pool_obj_t *)(slab + i * p->obj_size);
+    o->next = p->free;
+    p->free = o;
+  }
+  p->capacity += per_slab;
+  return 0;
+}
+
+// node is the owning reactor's NUMA node (-1 for no preference): slabs are
+// bound there before their first touch.
+static void objpool_init(objpool_t *p, const char *name, size_t obj_size, size_t prealloc,
+                         int node) {
+  p->name = name;
+  p->node = node;
+  p->obj_size = (obj_size + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+  p->free = NULL;
+  p->in_use = 0;
+  p->capacity = 0;
+  while (p->capacity < prealloc) {
+    if (objpool_grow(p) < 0) die("mmap(slab)");
+  }
+}
+
+static void *objpool_get(objpool_t *p) {
+  if (!p->free && objpool_grow(p) < 0) return NULL;
+  pool_obj_t *o = p->free;
+  p->free = o->next;
+  p->in_use++;
+  return o;
+}
+
+static void objpool_put(objpool_t *p, void *obj) {
+  pool_obj_t *o = (pool_obj_t *)obj;
+  o->next = p->free;
+  p->free = o;
+  p->in_use--;
+}
+
+// ---- epoll engine ----
+// One thread per reactor, edge-triggered notifications, every socket non-blocking.
+// Each connection is a tiny state machine: it reads until EAGAIN, runs the
+// same transform chain as client_thread and writes the result back. If the
+// peer stops reading, unsent chunks queue up to the --out-hwm high-water
+// mark; then EPOLLIN is dropped from the interest set and EPOLLOUT added, and
+// reading resumes once the queue has drained to half. Zero-copy connections
+// run the same machine with a pipe in place of the chunk queue.
+// Chunks come in the RX_CLASSES sizes, one pool each; a connection holds
+// chunks only while data is in flight, so an idle one costs just its conn_t.
+// Timeouts run on a per-reactor timing wheel driven by one timerfd, which
+// only ticks (every TIMER_TICK_MS) while some connection has a timer armed.
+// With --offload, big reads are queued on the reactor's offload deque
+// untransformed; the chunk keeps its place in outq but flushes stop in front
+// of it until the pool hands it back, so the byte order on the wire holds.
+// A closed connection's memory waits for its last chunk out with the pool.
+// Reads draw on the connection's --rate-bytes/--rate-msgs buckets; an empty
+// one holds the connection, EPOLLIN dropped, until the wheel says it has
+// refilled. A connection past its --read-budget for the wakeup goes to the
+// back of the reactor's run queue, which is served once per loop iteration.
+// With --cache, small reads (whole frames with --framed) are looked up in the
+// reactor's response cache first and copied from there on a hit.
+
+struct conn;
+
+typedef enum {
+  HOLD_NONE,
+  HOLD_BUDGET, // on the run queue
+  HOLD_RATE    // waiting for resume_at
+} hold_t;
+
+// Doubly linked through the connections so a close unlinks in O(1).
+typedef struct {
+  struct conn *head;
+  struct conn **tail;
+  int count;
+} reactor_runq_t;
+
+typedef struct {
+  size_t len;
+  size_t cap;      // rx_class_size(cls)
+  int cls;
+  int pending;     // out with the offload pool: not to be written or freed yet
+  size_t raw;      // pending: bytes received, as counted in out_bytes
+  struct conn *owner;
+  offload_job_t job;
+  _Alignas(CACHE_LINE) unsigned char data[];
+} chunk_t;
+
+typedef struct {
+  objpool_t conns;              // conn_t
+  objpool_t chunks[RX_CLASSES]; // chunk_t by size class
+} reactor_mem_t;
+
+static chunk_t *chunk_get(reactor_mem_t *mem, int cls) {
+  chunk_t *ch = (chunk_t *)objpool_get(&mem->chunks[cls]);
+  if (!ch) return NULL;
+  ch->len = 0;
+  ch->cap = rx_class_size(cls);
+  ch->cls = cls;
+  ch->pending = 0;
+  return ch;
+}
+
+static void chunk_put(reactor_mem_t *mem, chunk_t *ch) {
+  objpool_put(&mem->chunks[ch->cls], ch);
+}
+
+typedef struct {
+  tw_wheel_t wheel;
+  int tfd;     // timerfd, -1 when no timeout is configured
+  int ticking; // tfd is armed
+  int ep;      // for closing expired connections
+} reactor_timers_t;
+
+typedef struct conn {
+  int fd;             // -1 once closed, while offloaded chunks are still out
+  reactor_mem_t *mem; // pools of the owning reactor
+  const transform_chain_t *chain;
+  chunk_t *outq[OUTQ_CAP]; // transformed chunks waiting to be written, oldest first
+  int out_head;
+  int out_count;
+  size_t out_off;          // bytes of outq[out_head] already sent
+  size_t out_bytes;        // unsent bytes across outq
+  int paused;              // reading stopped until the peer drains its output
+  uint32_t events;         // epoll interest currently registered
+  int eof;                 // peer finished sending; close once outq drains
+  int pipe_rd;             // splice pipe for zero-copy echo, -1 otherwise
+  int pipe_wr;
+  size_t piped;            // bytes sitting in the pipe, not yet spliced out
+  int rx_class;            // size class for the next read
+  chunk_t *in;             // --framed: received bytes not yet run through fp
+  size_t in_off;
+  frame_parser_t fp;
+  reactor_timers_t *timers;
+  tw_timer_t timer;
+  uint64_t deadline;       // wheel tick the current timeout runs out at
+  ktls_session_t *tls;     // TLS handshake in progress, NULL once in the kernel
+  offload_queue_t *offload; // the reactor's, NULL without --offload
+  int offloaded;           // chunks in outq still out with the pool
+  hold_t held;             // reading stopped by a rate limit or the read budget
+  size_t taken;            // bytes read in this wakeup, for --read-budget
+  uint64_t resume_at;      // HOLD_RATE: wheel tick to read again, else UINT64_MAX
+  bucket_t rate_bytes;
+  bucket_t rate_msgs;
+  reactor_runq_t *runq;
+  struct conn *run_next;
+  struct conn **run_pprev; // NULL while not on the run queue
+  int ipslot;              // ipcap_acquire() result, released on close
+  respcache_t *cache;      // the reactor's, NULL without --cache
+  uint64_t answered;       // reads (frames) taken in, for --close-after
+  int drain;               // DRAIN_*: how far --close-after has got
+} conn_t;
+
+enum {
+  DRAIN_NONE,
+  DRAIN_DUE,    // --close-after reached: answer what is under way, read no more
+  DRAIN_FIN_OUT // every reply and our FIN sent, discarding input until the client's
+};
+
+static void runq_push(reactor_runq_t *q, conn_t *c) {
+  c->run_next = NULL;
+  c->run_pprev = q->tail;
+  *q->tail = c;
+  q->tail = &c->run_next;
+  q->count++;
+}
+
+static void runq_remove(reactor_runq_t *q, conn_t *c) {
+  *c->run_pprev = c->run_next;
+  if (c->run_next) {
+    c->run_next->run_pprev = c->run_pprev;
+  } else {
+    q->tail = c->run_pprev;
+  }
+  c->run_pprev = NULL;
+  q->count--;
+}
+
+static void conn_release(conn_t *c) {
+  for (int i = 0; i < c->out_count; i++) {
+    chunk_put(c->mem, c->outq[(c->out_head + i) % OUTQ_CAP]);
+  }
+  if (c->in) chunk_put(c->mem, c->in);
+  objpool_put(&c->mem->conns, c);
+}
+
+static void conn_close(int ep, conn_t *c) {
+  tw_cancel(&c->timers->wheel, &c->timer);
+  epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+  if (c->pipe_rd >= 0) {
+    close(c->pipe_rd);
+    close(c->pipe_wr);
+  }
+#ifdef HAVE_OPENSSL
+  ktls_free(c->tls);
+  c->tls = NULL;
+#endif
+  if (c->run_pprev) runq_remove(c->runq, c);
+  ipcap_release(c->ipslot);
+  TRACE(TR_CLOSE, c->fd, 0);
+  close(c->fd);
+  c->fd = -1;
+  dec_clients();
+  if (c->offloaded == 0) conn_release(c);
+}
+
+static void conn_push(conn_t *c, chunk_t *ch) {
+  c->outq[(c->out_head + c->out_count) % OUTQ_CAP] = ch;
+  c->out_count++;
+  c->out_bytes += ch->len;
+}
+
+// Reading stops once the unsent output reaches the high-water mark (or the
+// queue runs out of slots) and resumes when the peer has drained it to half,
+// so a slow reader costs at most about --out-hwm bytes and no CPU.
+static int conn_backlogged(conn_t *c) {
+  if (c->out_bytes >= g_out_hwm || c->out_count == OUTQ_CAP) {
+    c->paused = 1;
+  } else if (c->out_bytes <= g_out_hwm / 2) {
+    c->paused = 0;
+  }
+  return c->paused;
+}
+
+// Whether the head of outq can go out, as opposed to nothing queued or the
+// head still being transformed on the offload pool.
+static int conn_sendable(const conn_t *c) {
+  return c->out_count > 0 && !c->outq[c->out_head]->pending;
+}
+
+// Write out what is queued, up to OUTQ_MAX chunks per writev. Returns 1 when
+// drained, 0 when the socket would block or the next chunk is still on the
+// offload pool, -1 on error.
+static int conn_flush(conn_t *c) {
+  if (g_metrics && c->out_count > 0) hist_add(HIST_OUTQ_BYTES, c->out_bytes);
+  while (c->out_count > 0) {
+    struct iovec iov[OUTQ_MAX];
+    int cnt = 0;
+    while (cnt < c->out_count && cnt < OUTQ_MAX) {
+      chunk_t *ch = c->outq[(c->out_head + cnt) % OUTQ_CAP];
+      if (ch->pending) break;
+      iov[cnt].iov_base = ch->data;
+      iov[cnt].iov_len = ch->len;
+      cnt++;
+    }
+    if (cnt == 0) return 0; // the completion brings us back
+    iov[0].iov_base = (unsigned char *)iov[0].iov_base + c->out_off;
+    iov[0].iov_len -= c->out_off;
+
+    ssize_t n = writev(c->fd, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        stat_add(STAT_EAGAIN_SEND, 1);
+        TRACE(TR_EAGAIN, c->fd, 1);
+        return 0;
+      }
+      return -1;
+    }
+    stat_add(STAT_BYTES_OUT, (uint64_t)n);
+    TRACE(TR_SEND, c->fd, n);
+    c->out_bytes -= (size_t)n;
+
+    size_t left = (size_t)n;
+    while (conn_sendable(c) && left >= c->outq[c->out_head]->len - c->out_off) {
+      chunk_t *ch = c->outq[c->out_head];
+      left -= ch->len - c->out_off;
+      c->out_off = 0;
+      c->out_head = (c->out_head + 1) % OUTQ_CAP;
+      c->out_count--;
+      chunk_put(c->mem, ch);
+    }
+    c->out_off += left;
+  }
+  return 1;
+}
+
+// Holds a connection whose bucket ran dry until the wheel tick by which it
+// holds a whole token again; conn_schedule arms the timer.
+static void conn_throttle(conn_t *c) {
+  uint64_t wait_us = 0;
+  if (g_rate_bytes) wait_us = bucket_wait_us(&c->rate_bytes, g_rate_bytes);
+  if (g_rate_msgs) {
+    uint64_t w = bucket_wait_us(&c->rate_msgs, g_rate_msgs);
+    if (w > wait_us) wait_us = w;
+  }
+  uint64_t ticks = (wait_us + TIMER_TICK_MS * 1000 - 1) / (TIMER_TICK_MS * 1000);
+  c->held = HOLD_RATE;
+  c->resume_at = c->timers->wheel.now + (ticks ? ticks : 1);
+  stat_add(STAT_THROTTLED, 1);
+}
+
+// Checked before every read. Returns 0 with the connection held, or 1 with
+// *allow the most the read may take (the bytes bucket's balance).
+static int conn_may_read(conn_t *c, size_t *allow) {
+  *allow = SIZE_MAX;
+  if (c->held != HOLD_NONE) return 0;
+  if (g_read_budget && c->taken >= g_read_budget) {
+    c->held = HOLD_BUDGET;
+    runq_push(c->runq, c);
+    stat_add(STAT_YIELDS, 1);
+    return 0;
+  }
+  if (g_rate_bytes || g_rate_msgs) {
+    uint64_t now = coarse_now_us();
+    int64_t bytes = g_rate_bytes ? bucket_refill(&c->rate_bytes, g_rate_bytes, now) : 1;
+    int64_t msgs = g_rate_msgs ? bucket_refill(&c->rate_msgs, g_rate_msgs, now) : 1;
+    if (bytes <= 0 || msgs <= 0) {
+      conn_throttle(c);
+      return 0;
+    }
+    if (g_rate_bytes && (uint64_t)bytes < *allow) *allow = (size_t)bytes;
+  }
+  return 1;
+}
+
+// Charges a read to the buckets; msgs can overdraw (--framed reads carry
+// any number of frames), which the next conn_may_read pays back.
+static void conn_charge(conn_t *c, size_t bytes, uint64_t msgs) {
+  c->taken += bytes;
+  if (g_rate_bytes) bucket_take(&c->rate_bytes, bytes);
+  if (g_rate_msgs) bucket_take(&c->rate_msgs, msgs);
+}
+
+// splice() variant of conn_flush: drain the pipe into the socket.
+// Counts n more messages taken in. At --close-after the connection stops
+// reading: a stream at once, as at EOF; --framed once the frame under way is
+// complete (conn_fill_framed). What it already holds is answered, then
+// conn_linger closes it.
+static void conn_answered(conn_t *c, uint64_t n) {
+  stat_add(STAT_MSGS, n);
+  c->answered += n;
+  if (!g_close_after || c->answered < g_close_after || c->drain != DRAIN_NONE) return;
+  c->drain = DRAIN_DUE;
+  if (!g_framed) c->eof = 1;
+}
+
+static int conn_flush_pipe(conn_t *c) {
+  while (c->piped > 0) {
+    ssize_t n = splice(c->pipe_rd, NULL, c->fd, NULL, c->piped,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        stat_add(STAT_EAGAIN_SEND, 1);
+        TRACE(TR_EAGAIN, c->fd, 1);
+        return 0;
+      }
+      return -1;
+    }
+    stat_add(STAT_BYTES_OUT, (uint64_t)n);
+    TRACE(TR_SEND, c->fd, n);
+    c->piped -= (size_t)n;
+  }
+  return 1;
+}
+
+// The pipe is the whole output queue here: reading pauses while it holds data.
+static int conn_pump_splice(conn_t *c) {
+  c->taken = 0;
+  while (1) {
+    // Only refill an empty pipe, so EAGAIN below always means the socket.
+    int fr = conn_flush_pipe(c);
+    if (fr < 0) {
+      perror("[server] splice(out)");
+      stat_add(STAT_ERRORS, 1);
+      return -1;
+    }
+    c->paused = fr == 0;
+    if (c->paused || c->eof) return 0;
+
+    size_t allow;
+    if (!conn_may_read(c, &allow)) return 0;
+    ssize_t r = splice(c->fd, NULL, c->pipe_wr, NULL,
+                       allow < SPLICE_PIPE_SIZE ? allow : SPLICE_PIPE_SIZE,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        stat_add(STAT_EAGAIN_RECV, 1);
+        TRACE(TR_EAGAIN, c->fd, 0);
+        return 0;
+      }
+      if (tls_alert() || peer_reset()) {
+        c->eof = 1;
+        return 0;
+      }
+      perror("[server] splice(in)");
+      stat_add(STAT_ERRORS, 1);
+      return -1;
+    }
+    if (r == 0) {
+      c->eof = 1;
+      return 0;
+    }
+    stat_add(STAT_BYTES_IN, (uint64_t)r);
+    conn_answered(c, 1);
+    TRACE(TR_READ, c->fd, r);
+    conn_charge(c, (size_t)r, 1);
+    c->piped = (size_t)r;
+  }
+}
+
+static void chunk_transform(offload_job_t *j) {
+  chunk_t *ch = (chunk_t *)((char *)j - offsetof(chunk_t, job));
+  ch->len = apply_chain(ch->owner->chain, ch->data, ch->raw);
+}
+
+// Queues a received chunk on outq and hands its transform to the pool. The
+// chunk's length is read by the pool thread, so it is queued first; a full
+// deque means the reactor is far enough behind to do the work itself.
+static void conn_offload(conn_t *c, chunk_t *ch, size_t n) {
+  ch->len = ch->raw = n;
+  ch->owner = c;
+  ch->job.run = chunk_transform;
+  ch->pending = 1;
+  conn_push(c, ch);
+  if (offload_submit(c->offload, &ch->job) == 0) {
+    c->offloaded++;
+    stat_add(STAT_OFFLOADED, 1);
+    return;
+  }
+  ch->pending = 0;
+  ch->len = apply_chain(c->chain, ch->data, n);
+  c->out_bytes += ch->len - n;
+}
+
+// --cache: the response to payload, found in the reactor's cache or else
+// transformed and stored there. With framed it is a whole response frame,
+// header and trailer included. Valid until the next cache call.
+static const unsigned char *cache_response(conn_t *c, const unsigned char *payload, size_t n,
+                                           int framed, size_t *len) {
+  uint64_t h = respcache_hash(payload, n);
+  const unsigned char *resp = respcache_get(c->cache, h, payload, n, len);
+  if (resp) {
+    stat_add(STAT_CACHE_HITS, 1);
+    return resp;
+  }
+  stat_add(STAT_CACHE_MISSES, 1);
+  unsigned char *buf = respcache_reserve(c->cache, h, payload, n);
+  size_t hdr = framed ? frame_put_len(buf, n + c->chain->trailer_len) : 0;
+  memcpy(buf + hdr, payload, n);
+  *len = hdr + apply_chain(c->chain, buf + hdr, n);
+  respcache_commit(c->cache, *len);
+  return buf;
+}
+
+// conn_fill_framed's shortcut for a frame that arrived whole and is small
+// enough for --cache: its response goes onto outq in one piece. Returns 1 if
+// it took the frame, -1 when out of memory, or 0 with *limit set to the input
+// the parser should get: no more than the current frame, so the shortcut
+// gets another look at the one after it.
+static int conn_fill_cached_frame(conn_t *c, size_t *limit) {
+  const unsigned char *in = c->in->data + c->in_off;
+  size_t avail = c->in->len - c->in_off, hdr = 0;
+  *limit = avail;
+  if (c->fp.in_payload) {
+    if (c->fp.len < avail) *limit = (size_t)c->fp.len;
+    return 0;
+  }
+  if (frame_pending(&c->fp)) {
+    *limit = 0; // a trailer to finish first
+    return 0;
+  }
+  if (c->fp.shift > 0) return 0;
+
+  uint64_t n = 0;
+  int shift = 0, st = 0;
+  while (st == 0 && hdr < avail) st = frame_len_step(&n, &shift, in[hdr++]);
+  if (st != 1) return 0; // split or malformed header: the parser's business
+  if (n > g_cache_max || avail - hdr < n) {
+    if (avail - hdr > n) *limit = hdr + (size_t)n;
+    return 0;
+  }
+
+  size_t len;
+  const unsigned char *resp = cache_response(c, in + hdr, (size_t)n, 1, &len);
+  chunk_t *out = NULL;
+  if (c->out_count > 0) {
+    out = c->outq[(c->out_head + c->out_count - 1) % OUTQ_CAP];
+    if (out->cap - out->len < len) out = NULL;
+  }
+  if (!out) {
+    int cls = c->rx_class;
+    while (rx_class_size(cls) < len) cls++; // CACHE_MAX_PAYLOAD leaves a class that fits
+    out = chunk_get(c->mem, cls);
+    if (!out) {
+      fprintf(stderr, "[server] out of chunk memory\n");
+      return -1;
+    }
+    conn_push(c, out);
+  }
+  memcpy(out->data + out->len, resp, len);
+  out->len += len;
+  c->out_bytes += len;
+
+  c->in_off += hdr + (size_t)n;
+  c->fp.frames++;
+  conn_answered(c, 1);
+  if (g_rate_msgs) bucket_take(&c->rate_msgs, 1);
+  if (c->in_off == c->in->len) {
+    chunk_put(c->mem, c->in);
+    c->in = NULL;
+  }
+  return 1;
+}
+
+// Reads and transforms chunks onto outq. Returns 1 once the socket is
+// drained (or hit EOF), 0 when the queue is backlogged or the connection
+// is held, -1 on error.
+static int conn_fill(conn_t *c) {
+  while (!conn_backlogged(c) && !c->eof) {
+    size_t allow;
+    if (!conn_may_read(c, &allow)) return 0;
+    chunk_t *ch = chunk_get(c->mem, c->rx_class);
+    if (!ch) {
+      fprintf(stderr, "[server] out of chunk memory\n");
+      return -1;
+    }
+
+    size_t room = ch->cap - c->chain->trailer_len;
+    if (room > allow) room = allow;
+    ssize_t r = recv(c->fd, ch->data, room, 0);
+    if (r <= 0) {
+      chunk_put(c->mem, ch);
+      if (r < 0 && errno == EINTR) continue;
+      if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && !tls_alert()) {
+        if (peer_reset()) return -1;
+        perror("[server] recv");
+        stat_add(STAT_ERRORS, 1);
+        return -1;
+      }
+      if (r < 0 && !tls_alert()) {
+        stat_add(STAT_EAGAIN_RECV, 1);
+        TRACE(TR_EAGAIN, c->fd, 0);
+      }
+      if (r == 0 || tls_alert()) c->eof = 1;
+      return 1;
+    }
+
+    stat_add(STAT_BYTES_IN, (uint64_t)r);
+    conn_answered(c, 1);
+    TRACE(TR_READ, c->fd, r);
+    conn_charge(c, (size_t)r, 1);
+    c->rx_class = rx_adapt(c->rx_class, (size_t)r, room);
+    if (c->cache && (size_t)r <= g_cache_max) {
+      const unsigned char *resp = cache_response(c, ch->data, (size_t)r, 0, &ch->len);
+      memcpy(ch->data, resp, ch->len);
+      conn_push(c, ch);
+      continue;
+    }
+    if (c->offload && (size_t)r >= g_offload_min) {
+      conn_offload(c, ch, (size_t)r);
+      continue;
+    }
+    ch->len = apply_chain(c->chain, ch->data, (size_t)r);
+    conn_push(c, ch);
+  }
+  return 0;
+}
+
+// conn_fill for --framed: runs received bytes through the frame parser,
+// appending the response stream to the tail of outq. A received chunk is
+// kept in c->in until the parser has consumed it and emitted all it owes for it.
+static int conn_fill_framed(conn_t *c) {
+  while (!conn_backlogged(c) && !c->eof) {
+    if (c->drain != DRAIN_NONE && !frame_partial(&c->fp) && !frame_pending(&c->fp)) {
+      c->eof = 1; // the rest of c->in goes to conn_linger
+      return 0;
+    }
+    if (!c->in) {
+      size_t allow;
+      if (!conn_may_read(c, &allow)) return 0;
+      chunk_t *ch = chunk_get(c->mem, c->rx_class);
+      if (!ch) {
+        fprintf(stderr, "[server] out of chunk memory\n");
+        return -1;
+      }
+      ssize_t r = recv(c->fd, ch->data, ch->cap < allow ? ch->cap : allow, 0);
+      if (r <= 0) {
+        chunk_put(c->mem, ch);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && !tls_alert()) {
+          if (peer_reset()) return -1;
+          perror("[server] recv");
+          stat_add(STAT_ERRORS, 1);
+          return -1;
+        }
+        if (r < 0 && !tls_alert()) {
+          stat_add(STAT_EAGAIN_RECV, 1);
+          TRACE(TR_EAGAIN, c->fd, 0);
+        }
+        if (r == 0 || tls_alert()) c->eof = 1;
+        return 1;
+      }
+      stat_add(STAT_BYTES_IN, (uint64_t)r);
+      TRACE(TR_READ, c->fd, r);
+      conn_charge(c, (size_t)r, 0);
+      c->rx_class = rx_adapt(c->rx_class, (size_t)r, ch->cap);
+      ch->len = (size_t)r;
+      c->in = ch;
+      c->in_off = 0;
+    }
+
+    size_t limit = c->in->len - c->in_off;
+    if (c->cache && c->drain == DRAIN_NONE) {
+      int took = conn_fill_cached_frame(c, &limit);
+      if (took < 0) return -1;
+      if (took) continue;
+    }
+    // --close-after: a frame at a time, so that none after the last is answered.
+    if (g_close_after) {
+      limit = c->drain != DRAIN_NONE && !frame_partial(&c->fp)
+                  ? 0 // only the last reply's trailer is left to write
+                  : frame_one(&c->fp, c->in->data + c->in_off, limit);
+    }
+
+    chunk_t *out = NULL;
+    if (c->out_count > 0) {
+      out = c->outq[(c->out_head + c->out_count - 1) % OUTQ_CAP];
+      if (out->len == out->cap) out = NULL;
+    }
+    if (!out) {
+      out = chunk_get(c->mem, c->rx_class);
+      if (!out) {
+        fprintf(stderr, "[server] out of chunk memory\n");
+        return -1;
+      }
+      conn_push(c, out);
+    }
+
+    uint64_t frames = c->fp.frames;
+    size_t used, wrote;
+    if (run_frames(&c->fp, c->chain, c->in->data + c->in_off, limit, &used,
+                  out->data + out->len, out->cap - out->len, &wrote) < 0) {
+      fprintf(stderr, "[server] malformed frame header, closing connection\n");
+      stat_add(STAT_ERRORS, 1);
+      return -1;
+    }
+    conn_answered(c, c->fp.frames - frames);
+    if (g_rate_msgs) bucket_take(&c->rate_msgs, c->fp.frames - frames);
+    out->len += wrote;
+    c->out_bytes += wrote;
+    c->in_off += used;
+    if (c->in_off == c->in->len && !frame_pending(&c->fp)) {
+      chunk_put(c->mem, c->in);
+      c->in = NULL;
+    }
+  }
+  return 0;
+}
+
+// Alternates flushing and reading until the socket has no more input, or
+// the socket is blocked with the queue backlogged. Returns -1 to close.
+static int conn_pump(conn_t *c) {
+  c->taken = 0;
+  while (1) {
+    int fr = conn_flush(c);
+    if (fr < 0) {
+      if (peer_reset()) return -1;
+      perror("[server] send");
+      stat_add(STAT_ERRORS, 1);
+      return -1;
+    }
+    if (c->eof) return 0;
+    if (fr == 0 && conn_backlogged(c)) return 0; // EPOLLOUT brings us back
+
+    int rr = g_framed ? conn_fill_framed(c) : conn_fill(c);
+    if (rr < 0) return -1;
+    if (rr == 1 || c->held != HOLD_NONE) {
+      if (conn_flush(c) < 0) {
+        if (peer_reset()) return -1;
+        perror("[server] send");
+        stat_add(STAT_ERRORS, 1);
+        return -1;
+      }
+      return 0;
+    }
+  }
+}
+
+// Keeps the registered interest in step with the connection: EPOLLIN only
+// while reading is allowed, EPOLLOUT only while output waits on the socket.
+// Most events change nothing and cost no epoll_ctl.
+static int conn_watch(int ep, conn_t *c) {
+  uint32_t want = EPOLLRDHUP | EPOLLET;
+  if ((!c->paused && !c->eof && c->held != HOLD_RATE) || c->drain == DRAIN_FIN_OUT) {
+    want |= EPOLLIN;
+  }
+  if (conn_sendable(c) || c->piped > 0) want |= EPOLLOUT;
+  if (want == c->events) return 0;
+
+  struct epoll_event ev;
+  ev.events = want;
+  ev.data.ptr = c;
+  if (epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev) < 0) {
+    perror("[server] epoll_ctl");
+    return -1;
+  }
+  c->events = want;
+  return 0;
+}
+
+// ---- connection timeouts ----
+// Output stuck on the socket is under the write timeout, a half-received
+// frame under the read timeout, anything else under the idle timeout. Every
+// event restarts the clock, but the timer only moves when the deadline gets
+// earlier: a later one is picked up when the old deadline fires, so a busy
+// connection costs no wheel operation per event.
+
+static long conn_timeout_ms(const conn_t *c) {
+  if (c->drain == DRAIN_FIN_OUT) return drain_ms();
+  if (c->tls) return g_read_timeout_ms;
+  if (c->held == HOLD_RATE) return conn_sendable(c) ? g_write_timeout_ms : 0; // our doing
+  if (conn_sendable(c) || c->piped > 0) return g_write_timeout_ms;
+  if (c->in || frame_partial(&c->fp)) return g_read_timeout_ms;
+  return g_idle_timeout_ms;
+}
+
+static void timers_start(reactor_timers_t *tm) {
+  if (tm->ticking) return;
+  struct itimerspec its;
+  its.it_interval.tv_sec = 0;
+  its.it_interval.tv_nsec = TIMER_TICK_MS * 1000000L;
+  its.it_value = its.it_interval;
+  if (timerfd_settime(tm->tfd, 0, &its, NULL) < 0) die("timerfd_settime");
+  tm->ticking = 1;
+}
+
+// The one timer per connection serves both the timeout and, while held by
+// a rate limit, the resume: it runs to whichever comes first.
+static uint64_t conn_due(const conn_t *c) {
+  return c->deadline < c->resume_at ? c->deadline : c->resume_at;
+}
+
+static void conn_schedule(conn_t *c) {
+  reactor_timers_t *tm = c->timers;
+  if (tm->tfd < 0) return;
+  long ms = conn_timeout_ms(c);
+  c->deadline = ms ? tm->wheel.now + (uint64_t)(ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS
+                   : UINT64_MAX;
+  uint64_t due = conn_due(c);
+  if (due == UINT64_MAX) {
+    tw_cancel(&tm->wheel, &c->timer);
+    return;
+  }
+  if (!tw_armed(&c->timer) || c->timer.expires > due) {
+    tw_arm(&tm->wheel, &c->timer, due);
+    timers_start(tm);
+  }
+}
+
+static int conn_on_event(int ep, conn_t *c, uint32_t events);
+
+static void conn_expire(tw_timer_t *t, void *arg) {
+  reactor_timers_t *tm = (reactor_timers_t *)arg;
+  conn_t *c = (conn_t *)((char *)t - offsetof(conn_t, timer));
+  if (c->resume_at <= tm->wheel.now) {
+    c->held = HOLD_NONE;
+    c->resume_at = UINT64_MAX;
+    if (conn_on_event(tm->ep, c, EPOLLIN) < 0) conn_close(tm->ep, c);
+    return;
+  }
+  if (c->deadline > tm->wheel.now) {
+    if (conn_due(c) != UINT64_MAX) tw_arm(&tm->wheel, t, conn_due(c));
+    return;
+  }
+  stat_add(STAT_TIMEOUTS, 1);
+  conn_close(tm->ep, c);
+}
+
+// Called after an event batch, never in the middle of one, so no closed
+// connection is left behind in the batch.
+static void timers_run(reactor_timers_t *tm) {
+  uint64_t ticks;
+  if (read(tm->tfd, &ticks, sizeof(ticks)) != (ssize_t)sizeof(ticks)) return;
+  // The wheel's clock only needs to run while it holds timers.
+  while (ticks-- > 0 && tm->wheel.count > 0) tw_tick(&tm->wheel, conn_expire, tm);
+  if (tm->wheel.count == 0) {
+    struct itimerspec off;
+    memset(&off, 0, sizeof(off));
+    timerfd_settime(tm->tfd, 0, &off, NULL);
+    tm->ticking = 0;
+  }
+}
+
+// --close-after, once every reply is out: sends the FIN, then discards input
+// until the client's arrives (see linger_close), under the drain timeout.
+// Returns 0 to keep waiting, -1 to close.
+static int conn_linger(int ep, conn_t *c) {
+  if (c->drain == DRAIN_DUE) {
+    c->drain = DRAIN_FIN_OUT;
+    if (c->in) {
+      count_discarded(g_framed ? &c->fp : NULL, c->in->data + c->in_off, c->in->len - c->in_off);
+      chunk_put(c->mem, c->in);
+      c->in = NULL;
+    }
+    if (shutdown(c->fd, SHUT_WR) < 0) return -1;
+  }
+  unsigned char buf[4096];
+  while (1) {
+    ssize_t r = recv(c->fd, buf, sizeof(buf), 0);
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    if (r < 0) peer_reset();
+    if (r <= 0) return -1;
+    count_discarded(g_framed ? &c->fp : NULL, buf, (size_t)r);
+  }
+  conn_schedule(c);
+  return conn_watch(ep, c);
+}
+
+// Returns 0 to keep the connection, -1 to close it.
+static int conn_on_event(int ep, conn_t *c, uint32_t events) {
+  if (events & EPOLLERR) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    errno = err;
+    peer_reset();
+    return -1;
+  }
+  if (c->drain == DRAIN_FIN_OUT) return conn_linger(ep, c);
+#ifdef HAVE_OPENSSL
+  // The handshake listens for both directions (edge-triggered, so that costs
+  // nothing); once done, data the client sent right behind it is read below.
+  if (c->tls) {
+    ktls_status_t st = ktls_handshake(c->tls);
+    if (st == KTLS_FAILED) {
+      perror("[server] tls handshake");
+      stat_add(STAT_ERRORS, 1);
+      return -1;
+    }
+    conn_schedule(c);
+    if (st != KTLS_DONE) return 0;
+    ktls_free(c->tls);
+    c->tls = NULL;
+  }
+#endif
+  int rc = c->pipe_rd >= 0 ? conn_pump_splice(c) : conn_pump(c);
+  if (rc < 0) return -1;
+  if (c->eof && c->out_count == 0 && c->piped == 0) {
+    return c->drain == DRAIN_DUE ? conn_linger(ep, c) : -1;
+  }
+  conn_schedule(c);
+  return conn_watch(ep, c);
+}
+
+// Sets up a freshly accepted non-blocking socket as a connection.
+static void epoll_add_conn(int ep, int client_fd, const transform_chain_t *chain,
+                           reactor_mem_t *mem, reactor_timers_t *timers,
+                           offload_queue_t *offload, reactor_runq_t *runq, int ipslot,
+                           respcache_t *cache) {
+  conn_t *c = (conn_t *)objpool_get(&mem->conns);
+  if (!c) {
+    fprintf(stderr, "[server] out of connection memory\n");
+    ipcap_release(ipslot);
+    close(client_fd);
+    return;
+  }
+  c->fd = client_fd;
+  c->mem = mem;
+  c->chain = chain;
+  c->out_head = c->out_count = 0;
+  c->out_off = 0;
+  c->out_bytes = 0;
+  c->paused = 0;
+  c->eof = 0;
+  c->answered = 0;
+  c->drain = DRAIN_NONE;
+  c->pipe_rd = c->pipe_wr = -1;
+  c->piped = 0;
+  c->rx_class = RX_START_CLASS;
+  c->in = NULL;
+  c->in_off = 0;
+  frame_parser_init(&c->fp, chain);
+  c->timers = timers;
+  c->timer.next = NULL;
+  c->tls = NULL;
+  c->offload = g_framed ? NULL : offload;
+  c->offloaded = 0;
+  c->held = HOLD_NONE;
+  c->resume_at = UINT64_MAX;
+  if (g_rate_bytes || g_rate_msgs) {
+    uint64_t now = coarse_now_us();
+    bucket_init(&c->rate_bytes, g_rate_bytes, now);
+    bucket_init(&c->rate_msgs, g_rate_msgs, now);
+  }
+  c->runq = runq;
+  c->run_pprev = NULL;
+  c->ipslot = ipslot;
+  c->cache = cache;
+  if (use_splice(chain)) {
+    int p[2];
+    if (open_splice_pipe(p) < 0) {
+      perror("[server] pipe2");
+      ipcap_release(ipslot);
+      close(client_fd);
+      objpool_put(&mem->conns, c);
+      return;
+    }
+    c->pipe_rd = p[0];
+    c->pipe_wr = p[1];
+  }
+
+  inc_clients();
+  TRACE(TR_ACCEPT, client_fd, 0);
+
+  struct epoll_event ev;
+  ev.events = c->events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+#ifdef HAVE_OPENSSL
+  if (g_tls) {
+    c->tls = ktls_start(client_fd);
+    if (!c->tls) {
+      fprintf(stderr, "[server] tls: out of memory\n");
+      conn_close(ep, c);
+      return;
+    }
+    ev.events = c->events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  }
+#endif
+  ev.data.ptr = c;
+  if (epoll_ctl(ep, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+    perror("[server] epoll_ctl");
+    conn_close(ep, c);
+    return;
+  }
+  conn_schedule(c);
+}
+
+// The listener is edge-triggered, so keep taking batches until one comes up short.
+// Peer addresses are only asked for when --max-conns-per-ip needs them.
+static void epoll_accept(int ep, int listen_fd, const transform_chain_t *chain,
+                         reactor_mem_t *mem, reactor_timers_t *timers,
+                         offload_queue_t *offload, reactor_runq_t *runq, respcache_t *cache) {
+  int fds[ACCEPT_BATCH];
+  struct sockaddr_storage addrs[ACCEPT_BATCH];
+  int n;
+  do {
+    n = accept_batch(listen_fd, SOCK_NONBLOCK | SOCK_CLOEXEC, fds,
+                     g_max_per_ip ? addrs : NULL, ACCEPT_BATCH);
+    for (int i = 0; i < n; i++) {
+      int slot = g_max_per_ip ? ipcap_acquire(&addrs[i]) : IPCAP_UNTRACKED;
+      if (slot == IPCAP_REFUSED) {
+        stat_add(STAT_REFUSED, 1);
+        close(fds[i]);
+        continue;
+      }
+      epoll_add_conn(ep, fds[i], chain, mem, timers, offload, runq, slot, cache);
+    }
+  } while (n == ACCEPT_BATCH);
+}
+
+// Gives each connection that yielded its read budget one more turn. Those
+// that use it up again go behind the ones queued meanwhile.
+static void runq_run(int ep, reactor_runq_t *q) {
+  for (int k = q->count; k > 0 && q->head; k--) {
+    conn_t *c = q->head;
+    runq_remove(q, c);
+    c->held = HOLD_NONE;
+    if (conn_on_event(ep, c, EPOLLIN) < 0) conn_close(ep, c);
+  }
+}
+
+// A chunk is back from the offload pool: account its final length and let
+// the connection write it (and whatever queued up behind it).
+static void offload_finish(int ep, offload_job_t *j) {
+  chunk_t *ch = (chunk_t *)((char *)j - offsetof(chunk_t, job));
+  conn_t *c = ch->owner;
+  c->out_bytes = c->out_bytes - ch->raw + ch->len;
+  ch->pending = 0;
+  c->offloaded--;
+  if (c->fd < 0) {
+    if (c->offloaded == 0) conn_release(c);
+    return;
+  }
+  if (conn_on_event(ep, c, EPOLLOUT) < 0) conn_close(ep, c);
+}
+
+typedef struct {
+  int id;
+  int cpu;       // CPU to pin to, -1 for no affinity
+  int node;      // NUMA node of cpu, where the reactor's memory lives; -1 if unpinned
+  int listen_fds[MAX_LISTENERS]; // one per g_listen entry: its own SO_REUSEPORT
+                                 // socket, or the Unix listener all reactors share
+  reactor_mem_t mem;
+  reactor_timers_t timers;
+  offload_queue_t offload; // set up only with --offload
+  reactor_runq_t runq;
+  respcache_t *cache[MAX_CHAINS]; // per chain its listeners use, only with --cache
+  pthread_t tid;
+  // Written only by the reactor thread (plain load + store), read by /metrics.
+  _Alignas(CACHE_LINE) _Atomic uint64_t loops;
+  _Atomic uint64_t events;
+  _Atomic uint64_t wait_ns; // blocked in epoll_wait / io_uring_submit_and_wait
+} reactor_t;
+
+static reactor_t *g_reactors[MAX_REACTORS]; // each allocated on its own node
+static _Atomic int g_nreactors; // set once the reactors exist
+
+static inline void counter_bump(_Atomic uint64_t *c, uint64_t n) {
+  atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+                        memory_order_relaxed);
+}
+
+// Called after every wait; t0 is when it started (0 while metrics are off).
+static void reactor_account(reactor_t *rt, int nevents, uint64_t t0) {
+  counter_bump(&rt->loops, 1);
+  if (nevents > 0) counter_bump(&rt->events, (uint64_t)nevents);
+  if (t0) counter_bump(&rt->wait_ns, now_ns() - t0);
+}
+
+static void reactor_pin(const reactor_t *rt) {
+  if (rt->cpu < 0) return;
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(rt->cpu, &set);
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err != 0) {
+    fprintf(stderr, "[server] reactor %d: pthread_setaffinity_np(cpu %d): %s\n",
+            rt->id, rt->cpu, strerror(err));
+  }
+}
+
+static void *epoll_reactor_thread(void *arg) {
+  reactor_t *rt = (reactor_t *)arg;
+
+  reactor_pin(rt);
+
+  // Initialised on the reactor thread so the first slabs are touched locally.
+  objpool_init(&rt->mem.conns, "conns", sizeof(conn_t), MAX_EVENTS, rt->node);
+  // Small chunks are preallocated; the bulk classes grow only if a sender needs them.
+  static const char *const chunk_names[RX_CLASSES] = {"chunks-1k",  "chunks-4k",
+                                                      "chunks-16k", "chunks-64k",
+                                                      "chunks-256k", "chunks-1m"};
+  for (int cls = 0; cls < RX_CLASSES; cls++) {
+    objpool_init(&rt->mem.chunks[cls], chunk_names[cls], sizeof(chunk_t) + rx_class_size(cls),
+                 cls <= RX_START_CLASS ? MAX_EVENTS : 0, rt->node);
+  }
+
+  reserve_fd();
+
+  int ep = epoll_create1(0);
+  if (ep < 0) die("epoll_create1");
+
+  // Listener entries point into rt->listen_fds, the timerfd at rt->timers,
+  // the offload eventfd at rt->offload, everything else at a conn_t.
+  for (int i = 0; i < g_nlisten; i++) {
+    struct epoll_event lev;
+    lev.events = EPOLLIN | EPOLLET | (listener_shared(&g_listen[i]) ? EPOLLEXCLUSIVE : 0);
+    lev.data.ptr = &rt->listen_fds[i];
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, rt->listen_fds[i], &lev) < 0) die("epoll_ctl(listen)");
+  }
+  const void *lis_begin = &rt->listen_fds[0], *lis_end = &rt->listen_fds[g_nlisten];
+
+  reactor_timers_t *tm = &rt->timers;
+  tw_init(&tm->wheel);
+  tm->ep = ep;
+  tm->ticking = 0;
+  tm->tfd = -1;
+  if (g_idle_timeout_ms || g_read_timeout_ms || g_write_timeout_ms || g_rate_bytes ||
+      g_rate_msgs || g_close_after) {
+    tm->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (tm->tfd < 0) die("timerfd_create");
+    struct epoll_event tev;
+    tev.events = EPOLLIN;
+    tev.data.ptr = tm;
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, tm->tfd, &tev) < 0) die("epoll_ctl(timerfd)");
+  }
+
+  offload_queue_t *oq = NULL;
+  if (g_offload_min) {
+    oq = &rt->offload;
+    if (offload_queue_init(oq) < 0) die("offload queue");
+    struct epoll_event oev;
+    oev.events = EPOLLIN;
+    oev.data.ptr = oq;
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, oq->efd, &oev) < 0) die("epoll_ctl(offload)");
+  }
+
+  // A response depends on the chain, so listeners with different chains get
+  // their own caches. Response buffers hold a frame header and the chain's
+  // trailer besides the payload.
+  for (int i = 0; g_cache_max && i < g_nlisten; i++) {
+    int ci = g_listen_chain[i];
+    if (rt->cache[ci]) continue;
+    rt->cache[ci] = respcache_create(g_cache_entries, g_cache_max,
+                                     FRAME_HDR_MAX + g_cache_max + g_chains[ci].trailer_len,
+                                     rt->node);
+    if (!rt->cache[ci]) die("response cache");
+  }
+
+  reactor_runq_t *rq = &rt->runq;
+  rq->head = NULL;
+  rq->tail = &rq->head;
+  rq->count = 0;
+
+  struct epoll_event events[MAX_EVENTS];
+  while (1) {
+    // With connections waiting their turn, or offload jobs of its own still
+    // queued, the reactor only polls; it helps the pool when there is no
+    // I/O to do at all.
+    int queued = oq && offload_queued(oq);
+    uint64_t t0 = g_metrics ? now_ns() : 0;
+    int n = epoll_wait(ep, events, MAX_EVENTS, queued || rq->head ? 0 : -1);
+    reactor_account(rt, n, t0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      die("epoll_wait");
+    }
+    if (n == 0 && queued && !rq->head) {
+      offload_job_t *j = offload_take(oq);
+      if (j) {
+        stat_add(STAT_RECLAIMED, 1);
+        j->run(j);
+        offload_finish(ep, j);
+      }
+      continue;
+    }
+
+    int tick = 0, done = 0;
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.ptr == tm) {
+        tick = 1;
+        continue;
+      }
+      if (events[i].data.ptr == oq) {
+        done = 1;
+        continue;
+      }
+      void *p = events[i].data.ptr;
+      if (p >= lis_begin && p < lis_end) {
+        int ci = g_listen_chain[(int *)p - rt->listen_fds];
+        epoll_accept(ep, *(int *)p, &g_chains[ci], &rt->mem, tm, oq, rq, rt->cache[ci]);
+        continue;
+      }
+      conn_t *c = (conn_t *)p;
+      if (conn_on_event(ep, c, events[i].events) < 0) conn_close(ep, c);
+    }
+    if (done) {
+      offload_job_t *j = offload_completed(oq);
+      while (j) {
+        offload_job_t *next = j->next;
+        offload_finish(ep, j);
+        j = next;
+      }
+    }
+    runq_run(ep, rq);
+    if (tick) timers_run(tm);
+  }
+  return NULL;
+}
+
+#ifdef HAVE_LIBURING
+// ---- io_uring engine ----
+// Steady state needs no recv/send syscalls: one multishot accept feeds new
+// sockets, each socket has one multishot recv that picks buffers from a
+// provided-buffer ring, and the transformed buffer goes straight back out as a
+// send SQE. All sends reaped for a connection in one batch are submitted as an
+// IOSQE_IO_LINK chain with MSG_WAITALL, so they complete in order and short
+// writes are retried by the kernel. A buffer returns to the ring once its send
+// completes; until then its bid sits on the connection's FIFO.
+
+#define URING_ENTRIES 4096
+#define URING_NBUFS 1024 // power of two, required by the buffer ring
+#define URING_BGID 0
+
+enum {
+  UOP_ACCEPT = 1,
+  UOP_RECV = 2,
+  UOP_SEND = 3
+};
+
+typedef struct uconn {
+  int fd;
+  int recv_armed;      // multishot recv outstanding
+  int sends_inflight;  // SQEs of the current linked chain not yet completed
+  int eof;             // peer is done sending; close once output drains
+  int closing;         // error path; drop queued output
+  int starved;         // on the reactor's starved list
+  int touched;         // on the reactor's touched list
+  int q_head, q_tail;  // FIFO of bids waiting to be sent, -1 when empty
+  const transform_chain_t *chain; // from the listener that accepted it
+  struct uconn *starved_next;
+  struct uconn *touched_next;
+} uconn_t;
+
+typedef struct {
+  struct io_uring ring;
+  struct io_uring_buf_ring *br;
+  unsigned char *bufs;
+  int buf_len[URING_NBUFS];
+  int buf_next[URING_NBUFS];  // links bids within a connection's FIFO
+  uconn_t *starved;           // connections whose recv hit -ENOBUFS
+  uconn_t *touched;           // connections to revisit after the CQE batch
+  objpool_t uconns;           // uconn_t
+  unsigned recv_len;          // buffer space offered to recv, leaves room for any trailer
+  const int *listen_fds;       // reactor_t's, one per g_listen entry
+} uring_reactor_t;
+
+// user_data = pointer | op in the low bits, bid in the top 16 bits.
+static uint64_t uring_tag(void *p, int op, int bid) {
+  return (uint64_t)(uintptr_t)p | (uint64_t)op | ((uint64_t)(unsigned)bid << 48);
+}
+
+static struct io_uring_sqe *uring_sqe(uring_reactor_t *ur) {
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&ur->ring);
+  while (!sqe) {
+    io_uring_submit(&ur->ring);
+    sqe = io_uring_get_sqe(&ur->ring);
+  }
+  return sqe;
+}
+
+// The listener's index rides in the bid field of the tag.
+static void uring_arm_accept(uring_reactor_t *ur, int lis) {
+  struct io_uring_sqe *sqe = uring_sqe(ur);
+  io_uring_prep_multishot_accept(sqe, ur->listen_fds[lis], NULL, NULL, SOCK_CLOEXEC);
+  io_uring_sqe_set_data64(sqe, uring_tag(NULL, UOP_ACCEPT, lis));
+}
+
+static void uring_arm_recv(uring_reactor_t *ur, uconn_t *c) {
+  struct io_uring_sqe *sqe = uring_sqe(ur);
+  io_uring_prep_recv_multishot(sqe, c->fd, NULL, 0, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BGID;
+  io_uring_sqe_set_data64(sqe, uring_tag(c, UOP_RECV, 0));
+  c->recv_armed = 1;
+}
+
+// Connections are never freed or sent to from inside a CQE handler; they are
+// queued here and handled once the whole batch has been reaped.
+static void uring_touch(uring_reactor_t *ur, uconn_t *c) {
+  if (c->touched) return;
+  c->touched = 1;
+  c->touched_next = ur->touched;
+  ur->touched = c;
+}
+
+static void uring_recycle(uring_reactor_t *ur, int bid) {
+  io_uring_buf_ring_add(ur->br, ur->bufs + (size_t)bid * BUF_SIZE, ur->recv_len,
+                        (unsigned short)bid, io_uring_buf_ring_mask(URING_NBUFS), 0);
+  io_uring_buf_ring_advance(ur->br, 1);
+
+  // A buffer is free again: give starved connections another multishot recv.
+  while (ur->starved) {
+    uconn_t *c = ur->starved;
+    ur->starved = c->starved_next;
+    c->starved = 0;
+    if (!c->closing) {
+      uring_arm_recv(ur, c);
+    } else {
+      uring_touch(ur, c);
+    }
+  }
+}
+
+static void uring_start_close(uring_reactor_t *ur, uconn_t *c) {
+  if (c->closing) return;
+  c->closing = 1;
+
+  // Drop output that was never submitted.
+  while (c->q_head >= 0) {
+    int next = ur->buf_next[c->q_head];
+    uring_recycle(ur, c->q_head);
+    c->q_head = next;
+  }
+  c->q_tail = -1;
+
+  // Wakes a pending recv so its multishot terminates.
+  shutdown(c->fd, SHUT_RDWR);
+  uring_touch(ur, c);
+}
+
+// Submits every queued bid as one linked chain, unless a chain is in flight.
+static void uring_kick_send(uring_reactor_t *ur, uconn_t *c) {
+  if (c->sends_inflight || c->q_head < 0) return;
+
+  while (c->q_head >= 0) {
+    int bid = c->q_head;
+    c->q_head = ur->buf_next[bid];
+    if (c->q_head < 0) c->q_tail = -1;
+
+    struct io_uring_sqe *sqe = uring_sqe(ur);
+    io_uring_prep_send(sqe, c->fd, ur->bufs + (size_t)bid * BUF_SIZE,
+                       (size_t)ur->buf_len[bid], MSG_WAITALL);
+    io_uring_sqe_set_data64(sqe, uring_tag(c, UOP_SEND, bid));
+    if (c->q_head >= 0) sqe->flags |= IOSQE_IO_LINK;
+    c->sends_inflight++;
+  }
+}
+
+static void uring_on_accept(uring_reactor_t *ur, int lis, struct io_uring_cqe *cqe) {
+  if (!(cqe->flags & IORING_CQE_F_MORE)) uring_arm_accept(ur, lis);
+  if (cqe->res == -EMFILE || cqe->res == -ENFILE) {
+    shed_connection(ur->listen_fds[lis]);
+    return;
+  }
+  if (cqe->res < 0) {
+    fprintf(stderr, "[server] accept: %s\n", strerror(-cqe->res));
+    return;
+  }
+
+  uconn_t *c = (uconn_t *)objpool_get(&ur->uconns);
+  if (!c) {
+    fprintf(stderr, "[server] out of connection memory\n");
+    close(cqe->res);
+    return;
+  }
+  memset(c, 0, sizeof(*c));
+  c->fd = cqe->res;
+  tune_socket(c->fd, ROLE_ACCEPTED);
+  c->q_head = c->q_tail = -1;
+  c->chain = &g_chains[g_listen_chain[lis]];
+  inc_clients();
+  TRACE(TR_ACCEPT, c->fd, 0);
+  uring_arm_recv(ur, c);
+}
+
+static void uring_on_recv(uring_reactor_t *ur, uconn_t *c, struct io_uring_cqe *cqe) {
+  if (!(cqe->flags & IORING_CQE_F_MORE)) c->recv_armed = 0;
+
+  if (cqe->res > 0) {
+    int bid = (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    if (c->closing) {
+      uring_recycle(ur, bid);
+      return;
+    }
+    stat_add(STAT_BYTES_IN, (uint64_t)cqe->res);
+    stat_add(STAT_MSGS, 1);
+    TRACE(TR_READ, c->fd, cqe->res);
+    ur->buf_len[bid] =
+        (int)apply_chain(c->chain, ur->bufs + (size_t)bid * BUF_SIZE, (size_t)cqe->res);
+    ur->buf_next[bid] = -1;
+    if (c->q_tail >= 0) {
+      ur->buf_next[c->q_tail] = bid;
+    } else {
+      c->q_head = bid;
+    }
+    c->q_tail = bid;
+    if (!c->recv_armed) uring_arm_recv(ur, c);
+    uring_touch(ur, c);
+  } else if (cqe->res == -ENOBUFS && !c->closing) {
+    if (!c->starved) {
+      c->starved = 1;
+      c->starved_next = ur->starved;
+      ur->starved = c;
+    }
+  } else if (cqe->res == 0 && !c->closing) {
+    c->eof = 1;
+    uring_touch(ur, c);
+  } else {
+    if (cqe->res < 0 && cqe->res != -ECONNRESET && !c->closing) {
+      fprintf(stderr, "[server] recv: %s\n", strerror(-cqe->res));
+      stat_add(STAT_ERRORS, 1);
+    }
+    uring_start_close(ur, c);
+  }
+}
+
+static void uring_on_send(uring_reactor_t *ur, uconn_t *c, int bid, struct io_uring_cqe *cqe) {
+  c->sends_inflight--;
+  if (cqe->res > 0) {
+    stat_add(STAT_BYTES_OUT, (uint64_t)cqe->res);
+    TRACE(TR_SEND, c->fd, cqe->res);
+  }
+  if (cqe->res < ur->buf_len[bid]) {
+    if (cqe->res < 0 && cqe->res != -ECANCELED && cqe->res != -EPIPE &&
+        cqe->res != -ECONNRESET) {
+      fprintf(stderr, "[server] send: %s\n", strerror(-cqe->res));
+      stat_add(STAT_ERRORS, 1);
+    }
+    uring_start_close(ur, c);
+  }
+  uring_recycle(ur, bid);
+  uring_touch(ur, c);
+}
+
+// Runs after each CQE batch: submit the next send chain, or free the
+// connection once nothing references it any more.
+static void uring_process_touched(uring_reactor_t *ur) {
+  while (ur->touched) {
+    uconn_t *c = ur->touched;
+    ur->touched = c->touched_next;
+    c->touched = 0;
+
+    if (!c->closing) uring_kick_send(ur, c);
+
+    int done = c->closing || (c->eof && c->q_head < 0);
+    if (done && !c->recv_armed && !c->sends_inflight && !c->starved) {
+      TRACE(TR_CLOSE, c->fd, 0);
+      close(c->fd);
+      objpool_put(&ur->uconns, c);
+      dec_clients();
+    }
+  }
+}
+
+static void *uring_reactor_thread(void *arg) {
+  reactor_t *rt = (reactor_t *)arg;
+  static __thread uring_reactor_t ur;
+
+  int err = io_uring_queue_init(URING_ENTRIES, &ur.ring, 0);
+  if (err < 0) {
+    fprintf(stderr, "[server] reactor %d: io_uring_queue_init: %s, falling back to epoll\n",
+            rt->id, strerror(-err));
+    return epoll_reactor_thread(arg);
+  }
+  ur.br = io_uring_setup_buf_ring(&ur.ring, URING_NBUFS, URING_BGID, 0, &err);
+  if (!ur.br) {
+    fprintf(stderr, "[server] reactor %d: io_uring_setup_buf_ring: %s, falling back to epoll\n",
+            rt->id, strerror(-err));
+    io_uring_queue_exit(&ur.ring);
+    return epoll_reactor_thread(arg);
+  }
+
+  reactor_pin(rt);
+
+  ur.listen_fds = rt->listen_fds;
+  reserve_fd();
+  objpool_init(&ur.uconns, "uconns", sizeof(uconn_t), MAX_EVENTS, rt->node);
+  ur.recv_len = (unsigned)(BUF_SIZE - g_trailer_max);
+  ur.bufs = (unsigned char *)topo_alloc((size_t)URING_NBUFS * BUF_SIZE, rt->node);
+  if (!ur.bufs) die("mmap(uring buffers)");
+  for (int bid = 0; bid < URING_NBUFS; bid++) {
+    io_uring_buf_ring_add(ur.br, ur.bufs + (size_t)bid * BUF_SIZE, ur.recv_len,
+                          (unsigned short)bid, io_uring_buf_ring_mask(URING_NBUFS), bid);
+  }
+  io_uring_buf_ring_advance(ur.br, URING_NBUFS);
+
+  for (int i = 0; i < g_nlisten; i++) uring_arm_accept(&ur, i);
+
+  while (1) {
+    uint64_t t0 = g_metrics ? now_ns() : 0;
+    err = io_uring_submit_and_wait(&ur.ring, 1);
+    reactor_account(rt, (int)io_uring_cq_ready(&ur.ring), t0);
+    if (err < 0 && err != -EINTR) {
+      fprintf(stderr, "[server] io_uring_submit_and_wait: %s\n", strerror(-err));
+      exit(EXIT_FAILURE);
+    }
+
+    // Transform everything that arrived first, then push one send chain per
+    // connection, so a burst of recv completions turns into linked SQEs.
+    struct io_uring_cqe *cqe;
+    unsigned head, seen = 0;
+
+    io_uring_for_each_cqe(&ur.ring, head, cqe) {
+      uint64_t tag = io_uring_cqe_get_data64(cqe);
+      int op = (int)(tag & 7);
+      int bid = (int)(tag >> 48);
+      uconn_t *c = (uconn_t *)(uintptr_t)(tag & 0x0000fffffffffff8ULL);
+
+      if (op == UOP_ACCEPT) {
+        uring_on_accept(&ur, bid, cqe);
+      } else if (op == UOP_RECV) {
+        uring_on_recv(&ur, c, cqe);
+      } else if (op == UOP_SEND) {
+        uring_on_send(&ur, c, bid, cqe);
+      }
+      seen++;
+    }
+    io_uring_cq_advance(&ur.ring, seen);
+
+    uring_process_touched(&ur);
+  }
+  return NULL;
+}
+#endif
+
+// With cpus set, reactor i is pinned to the i-th CPU of the set (cycling)
+// and its reactor_t, pools and buffers are placed on that CPU's node. With
+// incoming_cpu its TCP listeners also carry SO_INCOMING_CPU, so the kernel
+// prefers the reuseport socket of the reactor on the CPU that took the
+// packet: accept, protocol processing and the echo loop stay on one core.
+static void run_reactors(int nreactors, const cpu_set_t *cpus, int incoming_cpu,
+                         void *(*loop)(void *)) {
+  reactor_t **reactors = g_reactors;
+  int cpu_ids[CPU_SETSIZE];
+  int ncpu = 0;
+  for (int c = 0; cpus && c < CPU_SETSIZE; c++) {
+    if (CPU_ISSET(c, cpus)) cpu_ids[ncpu++] = c;
+  }
+
+  // Bind every listener up front so an address clash fails before any thread starts.
+  for (int i = 0; i < nreactors; i++) {
+    int cpu = ncpu ? cpu_ids[i % ncpu] : -1;
+    int node = cpu >= 0 ? topo_cpu_node(cpu) : -1;
+    reactor_t *rt = (reactor_t *)topo_alloc(sizeof(reactor_t), node);
+    if (!rt) die("mmap(reactor)");
+    reactors[i] = rt;
+    rt->id = i;
+    rt->cpu = cpu;
+    rt->node = node;
+    for (int l = 0; l < g_nlisten; l++) {
+      if (i > 0 && listener_shared(&g_listen[l])) {
+        rt->listen_fds[l] = reactors[0]->listen_fds[l];
+        continue;
+      }
+      rt->listen_fds[l] = open_listener(&g_listen[l], 1);
+      if (incoming_cpu && netaddr_family(&g_listen[l]) != AF_UNIX &&
+          setsockopt(rt->listen_fds[l], SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu)) < 0) {
+        perror("[server] setsockopt(SO_INCOMING_CPU)");
+      }
+    }
+  }
+  g_nreactors = nreactors;
+
+  for (int i = 0; i < nreactors; i++) {
+    int err = pthread_create(&reactors[i]->tid, NULL, loop, reactors[i]);
+    if (err != 0) {
+      fprintf(stderr, "[server] pthread_create(reactor %d): %s\n", i, strerror(err));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (int i = 0; i < nreactors; i++) pthread_join(reactors[i]->tid, NULL);
+  for (int i = 0; i < nreactors; i++) {
+    for (int l = 0; l < g_nlisten; l++) {
+      if (i == 0 || !listener_shared(&g_listen[l])) close(reactors[i]->listen_fds[l]);
+    }
+  }
+}
+
+// The CPUs to pin reactors to: those near --nic when sysfs knows the device,
+// otherwise every CPU this process may run on.
+static void pick_reactor_cpus(const char *nic, cpu_set_t *cpus) {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) die("sched_getaffinity");
+  *cpus = allowed;
+  if (!nic) return;
+
+  cpu_set_t local;
+  if (topo_nic_cpus(nic, &local) < 0) {
+    fprintf(stderr, "[server] %s: no device topology in sysfs, pinning across all CPUs\n", nic);
+    return;
+  }
+  CPU_AND(&local, &local, &allowed);
+  if (CPU_COUNT(&local) == 0) {
+    fprintf(stderr, "[server] %s: none of its local CPUs are available, pinning across all\n",
+            nic);
+    return;
+  }
+  *cpus = local;
+  int cpu = 0;
+  while (!CPU_ISSET(cpu, cpus)) cpu++;
+  fprintf(stderr, "[server] %s: reactors on its %d local CPUs (node %d)\n", nic,
+          CPU_COUNT(cpus), topo_cpu_node(cpu));
+}
+
+// ---- metrics endpoint ----
+// GET /metrics on --metrics-port renders the stats shards and the reactor
+// counters in Prometheus text format. Everything is summed at scrape time on
+// the admin thread; rates (accepts/s, bytes/s) are left to the scraper.
+
+static void render_metrics(mbuf_t *mb) {
+  uint64_t v[STAT_COUNT];
+  stats_sum(v);
+
+  static const struct {
+    const char *name;
+    const char *help;
+    int stat;
+  } counters[] = {
+      {"echo_accepted_connections_total", "Connections accepted.", STAT_OPENED},
+      {"echo_shed_connections_total", "Connections dropped at the descriptor limit.", STAT_SHED},
+      {"echo_received_bytes_total", "Payload bytes read from clients.", STAT_BYTES_IN},
+      {"echo_sent_bytes_total", "Bytes written back to clients.", STAT_BYTES_OUT},
+      {"echo_messages_total", "Reads (or frames, with --framed) echoed.", STAT_MSGS},
+      {"echo_errors_total", "Socket and protocol errors.", STAT_ERRORS},
+      {"echo_timeouts_total", "Connections closed by an idle, read or write timeout.",
+       STAT_TIMEOUTS},
+      {"echo_offloaded_messages_total", "Messages queued for the transform offload pool.",
+       STAT_OFFLOADED},
+      {"echo_offload_reclaimed_total",
+       "Offloaded messages an idle reactor took back and transformed itself.", STAT_RECLAIMED},
+      {"echo_throttled_reads_total", "Reads put off by a connection's byte or message rate.",
+       STAT_THROTTLED},
+      {"echo_read_budget_yields_total",
+       "Times a connection used up its read budget and let the others go first.", STAT_YIELDS},
+      {"echo_refused_connections_total", "Connections refused by the per-IP cap.",
+       STAT_REFUSED},
+      {"echo_response_cache_hits_total", "Messages answered from the response cache.",
+       STAT_CACHE_HITS},
+      {"echo_response_cache_misses_total",
+       "Messages small enough for the response cache that were not in it.", STAT_CACHE_MISSES},
+      {"echo_peer_resets_total", "Connections the client ended with an RST.", STAT_RESETS},
+      {"echo_discarded_messages_total",
+       "Reads (or frames) that arrived after --close-after and went unanswered.", STAT_DISCARDED},
+  };
+  for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+    metrics_header(mb, counters[i].name, "counter", counters[i].help);
+    metrics_u64(mb, counters[i].name, NULL, v[counters[i].stat]);
+  }
+  metrics_header(mb, "echo_active_connections", "gauge", "Connections currently open.");
+  metrics_u64(mb, "echo_active_connections", NULL, v[STAT_OPENED] - v[STAT_CLOSED]);
+  metrics_header(mb, "echo_eagain_total", "counter",
+                 "Non-blocking reads and writes that returned EAGAIN.");
+  metrics_u64(mb, "echo_eagain_total", "op=\"recv\"", v[STAT_EAGAIN_RECV]);
+  metrics_u64(mb, "echo_eagain_total", "op=\"send\"", v[STAT_EAGAIN_SEND]);
+
+  hist_snap_t h[HIST_COUNT];
+  memset(h, 0, sizeof(h));
+  for (int i = 0; i < STATS_SHARDS; i++) {
+    for (int k = 0; k < HIST_COUNT; k++) hist_snap_add(&h[k], &g_stats[i].h[k]);
+  }
+  metrics_histogram(mb, "echo_transform_seconds",
+                    "Time in the transform chain per message (per parser run with --framed).",
+                    &h[HIST_TRANSFORM_NS], 1e-9);
+  metrics_histogram(mb, "echo_send_queue_bytes",
+                    "Unsent bytes queued on an epoll connection when a flush starts.",
+                    &h[HIST_OUTQ_BYTES], 1.0);
+
+  int n = atomic_load(&g_nreactors);
+  if (n == 0) return;
+  static const struct {
+    const char *name;
+    const char *help;
+    size_t offset;
+    double unit;
+  } per_reactor[] = {
+      {"echo_reactor_loop_iterations_total", "Event loop wakeups.",
+       offsetof(reactor_t, loops), 1.0},
+      {"echo_reactor_events_total", "Events (or completions) handled.",
+       offsetof(reactor_t, events), 1.0},
+      {"echo_reactor_wait_seconds_total", "Time blocked in epoll_wait or io_uring_submit_and_wait.",
+       offsetof(reactor_t, wait_ns), 1e-9},
+  };
+  for (size_t k = 0; k < sizeof(per_reactor) / sizeof(per_reactor[0]); k++) {
+    metrics_header(mb, per_reactor[k].name, "counter", per_reactor[k].help);
+    for (int i = 0; i < n; i++) {
+      char label[32];
+      snprintf(label, sizeof(label), "reactor=\"%d\"", i);
+      _Atomic uint64_t *c = (_Atomic uint64_t *)((char *)g_reactors[i] + per_reactor[k].offset);
+      uint64_t x = atomic_load_explicit(c, memory_order_relaxed);
+      if (per_reactor[k].unit == 1.0) {
+        metrics_u64(mb, per_reactor[k].name, label, x);
+      } else {
+        metrics_double(mb, per_reactor[k].name, label, (double)x * per_reactor[k].unit);
+      }
+    }
+  }
+}
+
+static void *metrics_thread(void *arg) {
+  metrics_serve((int)(intptr_t)arg, render_metrics);
+  return NULL;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "Usage: %s [port] [--mode=thread|pool|epoll|uring]\n"
+          "          [--reactors=N] [--pin]                     (epoll, uring)\n"
+          "          [--nic=IFNAME]      pin to the CPUs local to that NIC (implies --pin)\n"
+          "          [--incoming-cpu]    steer connections to the reactor on the receiving CPU\n"
+          "          [--workers=N] [--queue=N] [--backpressure=wait|reject] (pool)\n"
+          "          [--transform=STAGE[,STAGE...]]   stages: %s (default upper)\n"
+          "          [--zero-copy]       splice() echo, needs --transform=echo\n"
+          "          [--framed]          varint length-prefixed TCP messages\n"
+          "          [--out-hwm=BYTES]   unsent bytes per connection before reads pause (epoll)\n"
+          "          [--offload=BYTES] [--offload-threads=N]  transform reads of BYTES or more\n"
+          "                              on a work-stealing pool (epoll, default N = CPUs)\n"
+          "          [--rate-bytes=N] [--rate-msgs=N]  per-connection limits per second (epoll)\n"
+          "          [--read-budget=BYTES]  per connection and wakeup before others go (epoll)\n"
+          "          [--max-conns-per-ip=N] IPv6 counted per /64 (epoll)\n"
+          "          [--cache=BYTES] [--cache-entries=N]  answer repeated payloads of up to\n"
+          "                              BYTES from a per-reactor cache (epoll, default N 4096)\n"
+          "          [--close-after=N]   the server closes each connection after N reads\n"
+          "                              (frames), keeping TIME_WAIT off the clients\n"
+          "          [--idle-timeout=MS] [--read-timeout=MS] [--write-timeout=MS]\n"
+          "                              close silent, half-sent or unread connections\n"
+          "          [--backlog=N] [--nodelay] [--quickack] [--rcvbuf=BYTES] [--sndbuf=BYTES]\n"
+          "          [--busy-poll=USEC] [--defer-accept=SEC] [--fastopen=QLEN]  socket tuning\n"
+          "          [--listen=ADDR[,transform=SPEC]]  repeatable: 127.0.0.1:PORT, [::1]:PORT,\n"
+          "                              unix:/PATH, unix:@NAME (default 127.0.0.1 on [port]);\n"
+          "                              SPEC replaces --transform for that address\n"
+          "          [--tls-cert=PEM --tls-key=PEM]  TLS 1.3 via kernel TLS (make TLS=1)\n"
+          "          [--udp]             also echo UDP datagrams on the same port\n"
+          "          [--shm=unix:ADDR[,transform=SPEC]] [--shm-ring=BYTES]  shared-memory ring\n"
+          "                              sessions\n"
+          "          [--stats-interval=MS]   summary line period, 0 = off (default 1000)\n"
+          "          [--metrics-port=PORT]   Prometheus GET /metrics on 127.0.0.1:PORT\n"
+          "          [--trace=FILE] [--trace-on-signal]  per-message event trace, written\n"
+          "                              continuously or on SIGUSR2 (make TRACE=1)\n"
+          "          [--strict-locale]   use toupper() from the environment's locale\n",
+          prog, transform_stage_names());
+}
+
+// --listen=ADDR,transform=SPEC and --shm=unix:ADDR,transform=SPEC: SPEC is the
+// rest of the argument, commas and all. Copies ADDR to addr and returns SPEC,
+// or NULL when the address has no chain of its own.
+static const char *split_transform(const char *arg, char *addr, size_t len) {
+  const char *tx = strstr(arg, ",transform=");
+  size_t n = tx ? (size_t)(tx - arg) : strlen(arg);
+  snprintf(addr, len, "%.*s", (int)n, arg);
+  return tx ? tx + 11 : NULL;
+}
+
+// Index in g_chains of the chain spelled spec, parsed the first time it is
+// seen; -1 with the unknown stage in bad.
+static int chain_add(const char *spec, char *bad, size_t bad_len) {
+  for (int i = 0; i < g_nchains; i++) {
+    if (strcmp(g_chain_spec[i], spec) == 0) return i;
+  }
+  transform_chain_t *chain = &g_chains[g_nchains];
+  if (transform_chain_parse(chain, spec, bad, bad_len) < 0) return -1;
+  if (chain->trailer_len > g_trailer_max) g_trailer_max = chain->trailer_len;
+  g_chain_spec[g_nchains] = spec;
+  return g_nchains++;
+}
+
+#ifdef HAVE_LIBURING
+// The io_uring engine is the plain stream echo only: the first option it
+// has no support for, or NULL. Such runs are refused rather than quietly
+// served by another engine under its name.
+static const char *uring_unsupported(void) {
+  if (g_zero_copy) return "--zero-copy";
+  if (g_framed) return "--framed";
+  if (g_idle_timeout_ms || g_read_timeout_ms || g_write_timeout_ms) return "--idle/--read/--write-timeout";
+  if (g_tls) return "--tls-cert";
+  if (g_offload_min) return "--offload";
+  if (g_rate_bytes || g_rate_msgs || g_read_budget || g_max_per_ip) {
+    return "--rate-*, --read-budget and --max-conns-per-ip";
+  }
+  if (g_cache_max) return "--cache";
+  if (g_close_after) return "--close-after";
+  return NULL;
+}
+#endif
+
+int main(int argc, char **argv) {
+  signal(SIGPIPE, SIG_IGN);
+
+  int port = DEFAULT_PORT;
+  engine_t engine = ENGINE_THREAD;
+  int nreactors = 0; // 0 = not given on the command line
+  int pin = 0;
+  const char *nic = NULL;
+  int incoming_cpu = 0;
+  int nworkers = DEFAULT_WORKERS;
+  int offload_threads = 0; // 0 = one per online CPU
+  long queue_len = DEFAULT_QUEUE;
+  backpressure_t bp = BACKPRESSURE_WAIT;
+  int strict_locale = 0;
+  int udp = 0;
+  long stats_ms = 1000;
+  int metrics_port = 0;
+  const char *listen_specs[MAX_LISTENERS];
+  const char *tls_cert = NULL, *tls_key = NULL;
+  const char *shm_spec = NULL;
+  const char *trace_path = NULL;
+  int trace_on_signal = 0;
+  const char *transform_spec = "upper";
+
+  sockopt_defaults(&g_sockopts);
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    int so = sockopt_parse(&g_sockopts, arg);
+    if (so < 0) {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+    if (so > 0) continue;
+    if (strncmp(arg, "--mode=", 7) == 0) {
+      const char *m = arg + 7;
+      if (strcmp(m, "thread") == 0) {
+        engine = ENGINE_THREAD;
+      } else if (strcmp(m, "pool") == 0) {
+        engine = ENGINE_POOL;
+      } else if (strcmp(m, "epoll") == 0) {
+        engine = ENGINE_EPOLL;
+      } else if (strcmp(m, "uring") == 0) {
+        engine = ENGINE_URING;
+      } else {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (strncmp(arg, "--reactors=", 11) == 0) {
+      nreactors = atoi(arg + 11);
+      if (nreactors <= 0 || nreactors > MAX_REACTORS) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(arg, "--pin") == 0) {
+      pin = 1;
+    } else if (strncmp(arg, "--nic=", 6) == 0) {
+      nic = arg + 6;
+      pin = 1;
+    } else if (strcmp(arg, "--incoming-cpu") == 0) {
+      incoming_cpu = 1;
+    } else if (strncmp(arg, "--transform=", 12) == 0) {
+      transform_spec = arg + 12;
+    } else if (strncmp(arg, "--stats-interval=", 17) == 0) {
+      stats_ms = atol(arg + 17);
+      if (stats_ms < 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (strncmp(arg, "--listen=", 9) == 0) {
+      if (g_nlisten == MAX_LISTENERS) {
+        fprintf(stderr, "[server] at most %d --listen addresses\n", MAX_LISTENERS);
+        return EXIT_FAILURE;
+      }
+      listen_specs[g_nlisten++] = arg + 9;
+    } else if (strncmp(arg, "--shm=", 6) == 0) {
+      shm_spec = arg + 6;
+    } else if (strncmp(arg, "--shm-ring=", 11) == 0) {
+      long v = atol(arg + 11);
+      if (v < SHM_RING_MIN || v > (1L << 30) || (v & (v - 1)) != 0) {
+        fprintf(stderr, "[server] --shm-ring wants a power of two from %d to 1 GB\n",
+                SHM_RING_MIN);
+        return EXIT_FAILURE;
+      }
+      g_shm_ring = (size_t)v;
+    } else if (strncmp(arg, "--tls-cert=", 11) == 0) {
+      tls_cert = arg + 11;
+    } else if (strncmp(arg, "--tls-key=", 10) == 0) {
+      tls_key = arg + 10;
+    } else if (strncmp(arg, "--metrics-port=", 15) == 0) {
+      metrics_port = atoi(arg + 15);
+      if (metrics_port <= 0 || metrics_port > 65535) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (strncmp(arg, "--trace=", 8) == 0) {
+      trace_path = arg + 8;
+    } else if (strcmp(arg, "--trace-on-signal") == 0) {
+      trace_on_signal = 1;
+    } else if (strcmp(arg, "--udp") == 0) {
+      udp = 1;
+    } else if (strcmp(arg, "--zero-copy") == 0) {
+      g_zero_copy = 1;
+    } else if (strcmp(arg, "--framed") == 0) {
+      g_framed = 1;
+    } else if (strncmp(arg, "--out-hwm=", 10) == 0) {
+      long hwm = atol(arg + 10);
+      if (hwm <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      g_out_hwm = (size_t)hwm;
+    } else if (strncmp(arg, "--offload=", 10) == 0) {
+      long v = atol(arg + 10);
+      if (v <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      g_offload_min = (size_t)v;
+    } else if (strncmp(arg, "--rate-bytes=", 13) == 0 || strncmp(arg, "--rate-msgs=", 12) == 0) {
+      long long v = atoll(strchr(arg, '=') + 1);
+      if (v <= 0 || v > 1000000000000LL) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      if (arg[7] == 'b') g_rate_bytes = (uint64_t)v;
+      if (arg[7] == 'm') g_rate_msgs = (uint64_t)v;
+    } else if (strncmp(arg, "--cache=", 8) == 0) {
+      long v = atol(arg + 8);
+      if (v <= 0 || v > CACHE_MAX_PAYLOAD) {
+        fprintf(stderr, "[server] --cache wants a payload size from 1 to %d bytes\n",
+                CACHE_MAX_PAYLOAD);
+        return EXIT_FAILURE;
+      }
+      g_cache_max = (size_t)v;
+    } else if (strncmp(arg, "--cache-entries=", 16) == 0) {
+      long v = atol(arg + 16);
+      if (v <= 0 || v > (1L << 24)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      g_cache_entries = (size_t)v;
+    } else if (strncmp(arg, "--close-after=", 14) == 0) {
+      long v = atol(arg + 14);
+      if (v <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      g_close_after = (uint64_t)v;
+    } else if (strncmp(arg, "--read-budget=", 14) == 0) {
+      long v = atol(arg + 14);
+      if (v <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      g_read_budget = (size_t)v;
+    } else if (strncmp(arg, "--max-conns-per-ip=", 19) == 0) {
+      g_max_per_ip = atol(arg + 19);
+      if (ipcap_init(g_max_per_ip) < 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (strncmp(arg, "--offload-threads=", 18) == 0) {
+      offload_threads = atoi(arg + 18);
+      if (offload_threads <= 0 || offload_threads > 1024) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (strncmp(arg, "--idle-timeout=", 15) == 0 ||
+               strncmp(arg, "--read-timeout=", 15) == 0 ||
+               strncmp(arg, "--write-timeout=", 16) == 0) {
+      const char *v = strchr(arg, '=') + 1;
+      long ms = atol(v);
+      if (ms < 0 || ms > 86400000L) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+      if (arg[2] == 'i') g_idle_timeout_ms = ms;
+      if (arg[2] == 'r') g_read_timeout_ms = ms;
+      if (arg[2] == 'w') g_write_timeout_ms = ms;
+    } else if (strcmp(arg, "--strict-locale") == 0) {
+      strict_locale = 1;
+    } else if (strncmp(arg, "--workers=", 10) == 0) {
+      nworkers = atoi(arg + 10);
+      if (nworkers <= 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (strncmp(arg, "--queue=", 8) == 0) {
+      queue_len = atol(arg + 8);
+      if (queue_len <= 0 || queue_len > (1L << 24)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (strncmp(arg, "--backpressure=", 15) == 0) {
+      const char *b = arg + 15;
+      if (strcmp(b, "wait") == 0) {
+        bp = BACKPRESSURE_WAIT;
+      } else if (strcmp(b, "reject") == 0) {
+        bp = BACKPRESSURE_REJECT;
+      } else {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    } else if (arg[0] == '-') {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    } else {
+      port = atoi(arg);
+      if (port <= 0 || port > 65535) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  // Parsed once the positional port is known, which is the default for
+  // addresses given without one.
+  const char *listen_tx[MAX_LISTENERS];
+  if (g_nlisten == 0) listen_specs[g_nlisten++] = "127.0.0.1";
+  for (int i = 0; i < g_nlisten; i++) {
+    char addr[256];
+    listen_tx[i] = split_transform(listen_specs[i], addr, sizeof(addr));
+    if (netaddr_parse(&g_listen[i], addr, port) < 0) {
+      fprintf(stderr, "[server] bad --listen address '%s'\n", addr);
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (g_read_timeout_ms == 0) g_read_timeout_ms = g_idle_timeout_ms;
+  if (g_write_timeout_ms == 0) g_write_timeout_ms = g_idle_timeout_ms;
+  if (strict_locale) setlocale(LC_CTYPE, "");
+  upper_init(strict_locale);
+  fprintf(stderr, "[server] to_uppercase kernel: %s\n", upper_kernel_name());
+
+  // g_chains[0] is --transform, the chain of every address without its own.
+  char bad[64], shm_path[256];
+  const char *shm_tx = shm_spec ? split_transform(shm_spec, shm_path, sizeof(shm_path)) : NULL;
+  int shm_chain = 0;
+  int ok = chain_add(transform_spec, bad, sizeof(bad)) == 0;
+  for (int i = 0; ok && i < g_nlisten; i++) {
+    g_listen_chain[i] = listen_tx[i] ? chain_add(listen_tx[i], bad, sizeof(bad)) : 0;
+    ok = g_listen_chain[i] >= 0;
+  }
+  if (ok && shm_tx) {
+    shm_chain = chain_add(shm_tx, bad, sizeof(bad));
+    ok = shm_chain >= 0;
+  }
+  if (!ok) {
+    fprintf(stderr, "[server] unknown transform stage \"%s\" (known: %s)\n", bad,
+            transform_stage_names());
+    return EXIT_FAILURE;
+  }
+  char chain_desc[128];
+  transform_chain_describe(&g_chains[0], chain_desc, sizeof(chain_desc));
+  fprintf(stderr, "[server] transform: %s%s%s\n", chain_desc, g_zero_copy ? " (zero-copy)" : "",
+          g_framed ? " (framed)" : "");
+  for (int i = 0; i < g_nlisten; i++) {
+    if (g_listen_chain[i] == 0) continue;
+    transform_chain_describe(&g_chains[g_listen_chain[i]], chain_desc, sizeof(chain_desc));
+    fprintf(stderr, "[server] transform on %s: %s\n", g_listen[i].text, chain_desc);
+  }
+  for (int i = 0; i < g_nchains; i++) {
+    if (g_zero_copy && g_chains[i].nstages != 0) {
+      fprintf(stderr, "[server] --zero-copy only works with --transform=echo on every address\n");
+      return EXIT_FAILURE;
+    }
+    frame_parser_t probe;
+    if (g_framed && frame_parser_init(&probe, &g_chains[i]) < 0) {
+      fprintf(stderr, "[server] transform trailer too long for --framed\n");
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (tls_cert || tls_key) {
+    if (!tls_cert || !tls_key) {
+      fprintf(stderr, "[server] TLS needs both --tls-cert and --tls-key\n");
+      return EXIT_FAILURE;
+    }
+#ifdef HAVE_OPENSSL
+    // Kernel TLS sits on TCP: nothing to hand the keys to for the rest.
+    for (int i = 0; i < g_nlisten; i++) {
+      if (netaddr_family(&g_listen[i]) == AF_UNIX) {
+        fprintf(stderr, "[server] TLS cannot cover %s (kernel TLS is TCP only)\n",
+                g_listen[i].text);
+        return EXIT_FAILURE;
+      }
+    }
+    if (udp) {
+      fprintf(stderr, "[server] --udp would be cleartext next to TLS, not both\n");
+      return EXIT_FAILURE;
+    }
+    if (ktls_probe() < 0) {
+      fprintf(stderr, "[server] kernel TLS unavailable (%s); try modprobe tls\n",
+              strerror(errno));
+      return EXIT_FAILURE;
+    }
+    if (ktls_init(tls_cert, tls_key) < 0) return EXIT_FAILURE;
+    g_tls = 1;
+    fprintf(stderr, "[server] tls: TLS 1.3, kernel record layer, %s\n", tls_cert);
+#else
+    fprintf(stderr, "[server] built without TLS (make TLS=1)\n");
+    return EXIT_FAILURE;
+#endif
+  }
+
+#ifdef HAVE_LIBURING
+  const char *no_uring = engine == ENGINE_URING ? uring_unsupported() : NULL;
+  if (no_uring) {
+    fprintf(stderr, "[server] %s: not supported by --mode=uring, use --mode=epoll\n", no_uring);
+    return EXIT_FAILURE;
+  }
+#else
+  if (engine == ENGINE_URING) {
+    fprintf(stderr, "[server] built without io_uring (make IOURING=1), using epoll\n");
+    engine = ENGINE_EPOLL;
+  }
+#endif
+
+  if (engine != ENGINE_EPOLL && engine != ENGINE_URING && (nreactors > 0 || pin)) {
+    fprintf(stderr, "[server] --reactors/--pin/--nic need --mode=epoll or --mode=uring\n");
+    return EXIT_FAILURE;
+  }
+  if (incoming_cpu && !pin) {
+    fprintf(stderr, "[server] --incoming-cpu needs --pin or --nic\n");
+    return EXIT_FAILURE;
+  }
+  if (g_offload_min && engine != ENGINE_EPOLL) {
+    fprintf(stderr, "[server] --offload needs --mode=epoll (the blocking engines already "
+                    "transform off any shared loop)\n");
+    return EXIT_FAILURE;
+  }
+  if ((g_rate_bytes || g_rate_msgs || g_read_budget || g_max_per_ip) && engine != ENGINE_EPOLL) {
+    fprintf(stderr, "[server] --rate-*, --read-budget and --max-conns-per-ip need "
+                    "--mode=epoll\n");
+    return EXIT_FAILURE;
+  }
+  if (g_cache_max && engine != ENGINE_EPOLL) {
+    fprintf(stderr, "[server] --cache needs --mode=epoll\n");
+    return EXIT_FAILURE;
+  }
+  if (g_cache_max && g_zero_copy) {
+    fprintf(stderr, "[server] --cache has nothing to save with --zero-copy\n");
+    return EXIT_FAILURE;
+  }
+  if (g_offload_min && (g_framed || g_zero_copy)) {
+    fprintf(stderr, "[server] --offload covers the plain stream path, not --framed or "
+                    "--zero-copy\n");
+    return EXIT_FAILURE;
+  }
+  if (nreactors == 0) nreactors = 1;
+
+  if (trace_on_signal && !trace_path) {
+    fprintf(stderr, "[server] --trace-on-signal needs --trace=FILE\n");
+    return EXIT_FAILURE;
+  }
+  if (trace_path) {
+#ifdef ECHO_TRACE
+    // Before the first thread, so every thread leaves SIGUSR2 to the writer.
+    if (trace_start(trace_path, trace_on_signal) < 0) die("trace");
+    fprintf(stderr, "[server] tracing to %s%s\n", trace_path,
+            trace_on_signal ? " on SIGUSR2" : "");
+#else
+    fprintf(stderr, "[server] built without tracing (make TRACE=1)\n");
+    return EXIT_FAILURE;
+#endif
+  }
+
+  if (stats_ms > 0) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, stats_thread, (void *)(intptr_t)stats_ms) != 0) {
+      die("pthread_create(stats)");
+    }
+    pthread_detach(tid);
+  }
+
+  if (metrics_port > 0) {
+    int mfd = metrics_listen(metrics_port);
+    if (mfd < 0) die("metrics listener");
+    g_metrics = 1;
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, metrics_thread, (void *)(intptr_t)mfd) != 0) {
+      die("pthread_create(metrics)");
+    }
+    pthread_detach(tid);
+    fprintf(stderr, "[server] metrics on http://127.0.0.1:%d/metrics\n", metrics_port);
+  }
+
+  if (shm_spec) {
+    netaddr_t shm_addr;
+    if (netaddr_parse(&shm_addr, shm_path, 0) < 0 || netaddr_family(&shm_addr) != AF_UNIX) {
+      fprintf(stderr, "[server] --shm wants unix:/PATH or unix:@NAME\n");
+      return EXIT_FAILURE;
+    }
+    start_shm(&shm_addr, &g_chains[shm_chain]);
+    transform_chain_describe(&g_chains[shm_chain], chain_desc, sizeof(chain_desc));
+    fprintf(stderr, "[server] shm sessions on %s (%zu KB rings, %s)\n", shm_addr.text,
+            g_shm_ring >> 10, chain_desc);
+  }
+
+  // One UDP socket per reactor (or a single one for the blocking engines).
+  if (udp) {
+    int n = start_udp(nreactors);
+    fprintf(stderr, "[server] udp echo on the IP listen addresses (%d socket%s, batch %d)\n",
+            n, n == 1 ? "" : "s", UDP_BATCH);
+  }
+
+  if (g_offload_min) {
+    if (offload_threads == 0) offload_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (offload_threads <= 0) offload_threads = 1;
+    if (offload_start(offload_threads) < 0) die("offload pool");
+    fprintf(stderr, "[server] offload: reads >= %zu bytes transformed on %d pool thread%s\n",
+            g_offload_min, offload_threads, offload_threads == 1 ? "" : "s");
+  }
+
+  if (g_cache_max) {
+    size_t per = g_cache_entries * (2 * g_cache_max + FRAME_HDR_MAX + g_trailer_max);
+    fprintf(stderr, "[server] response cache: %zu entries of payloads <= %zu bytes per reactor "
+                    "and transform chain (up to %zu KB each)\n",
+            g_cache_entries, g_cache_max, per >> 10);
+  }
+
+  if (engine == ENGINE_EPOLL || engine == ENGINE_URING) {
+    void *(*loop)(void *) = epoll_reactor_thread;
+#ifdef HAVE_LIBURING
+    if (engine == ENGINE_URING) loop = uring_reactor_thread;
+#endif
+    cpu_set_t cpus;
+    if (pin) pick_reactor_cpus(nic, &cpus);
+    fprintf(stderr, "[server] listening on %s (%s, %d reactor%s%s)\n", listen_desc(),
+            engine == ENGINE_URING ? "io_uring" : "epoll",
+            nreactors, nreactors == 1 ? "" : "s", pin ? ", pinned" : "");
+    run_reactors(nreactors, pin ? &cpus : NULL, incoming_cpu, loop);
+    return 0;
+  }
+
+  struct pollfd listeners[MAX_LISTENERS];
+  for (int i = 0; i < g_nlisten; i++) {
+    listeners[i].fd = open_listener(&g_listen[i], 0);
+    listeners[i].events = POLLIN;
+  }
+
+  if (engine == ENGINE_POOL) {
+    fprintf(stderr, "[server] listening on %s (pool, %d workers, queue %ld, %s)\n",
+            listen_desc(), nworkers, queue_len, bp == BACKPRESSURE_WAIT ? "wait" : "reject");
+    run_pool(listeners, g_nlisten, nworkers, (size_t)queue_len, bp);
+  } else {
+    fprintf(stderr, "[server] listening on %s (thread)\n", listen_desc());
+    run_threads(listeners, g_nlisten);
+  }
+
+  for (int i = 0; i < g_nlisten; i++) close(listeners[i].fd);
+  return 0;
+}
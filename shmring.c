@@ -0,0 +1,310 @@
+// shmring.c
+// Shared-memory session rings, see shmring.h.
+//
+// Records are an 8-byte header (the payload length) and the payload, padded
+// to 8 bytes, and never wrap: a record that would run past the end of the
+// ring is preceded by a pad header telling the consumer to skip to the
+// start. Counters only grow; head - tail is the ring's fill level.
+
+#define _GNU_SOURCE
+#include "shmring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHM_MAGIC 0x31524853u // "SHR1"
+#define SHM_PAD UINT32_MAX
+#define SHM_HDR 8
+#define SHM_SPIN 1000         // polls of the ring before sleeping, given a spare CPU
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+struct shm_ctl {
+  _Alignas(64) _Atomic uint64_t head; // written by the producer only
+  _Alignas(64) _Atomic uint64_t tail; // by the consumer only
+};
+
+struct shm_region {
+  uint32_t magic;
+  uint32_t pad;
+  uint64_t ring_bytes;
+  _Alignas(64) _Atomic uint32_t sleeping[2]; // indexed by shm_side_t
+  struct shm_ctl req;
+  struct shm_ctl resp;
+};
+
+#define SHM_DATA_OFF ((sizeof(struct shm_region) + 63) & ~(size_t)63)
+
+static size_t rec_size(size_t len) {
+  return (SHM_HDR + len + 7) & ~(size_t)7;
+}
+
+static void setup_views(shm_conn_t *c) {
+  struct shm_region *g = c->region;
+  unsigned char *base = (unsigned char *)g + SHM_DATA_OFF;
+  size_t cap = (size_t)g->ring_bytes;
+  shm_ring_t req = {&g->req, base, cap, 0, 0, 0, 0};
+  shm_ring_t resp = {&g->resp, base + cap, cap, 0, 0, 0, 0};
+  c->in = c->side == SHM_SERVER ? req : resp;
+  c->out = c->side == SHM_SERVER ? resp : req;
+  c->broken = 0;
+}
+
+int shm_offer(shm_conn_t *c, int sock, size_t ring_bytes) {
+  memset(c, 0, sizeof(*c));
+  c->side = SHM_SERVER;
+  c->sock = sock;
+  c->efd[0] = c->efd[1] = -1;
+  c->map_len = SHM_DATA_OFF + 2 * ring_bytes;
+
+  int mfd = memfd_create("echo-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (mfd < 0) return -1;
+  // Sealed at its size, so a client cannot truncate it under the server (SIGBUS).
+  if (ftruncate(mfd, (off_t)c->map_len) < 0 ||
+      fcntl(mfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+    goto fail;
+  }
+  void *p = mmap(NULL, c->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, mfd, 0);
+  if (p == MAP_FAILED) goto fail;
+  c->region = (struct shm_region *)p;
+  c->region->magic = SHM_MAGIC;
+  c->region->ring_bytes = ring_bytes;
+
+  c->efd[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  c->efd[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (c->efd[0] < 0 || c->efd[1] < 0) goto fail;
+
+  int fds[3] = {mfd, c->efd[SHM_SERVER], c->efd[SHM_CLIENT]};
+  char cbuf[CMSG_SPACE(sizeof(fds))];
+  char byte = 0;
+  struct iovec iov = {&byte, 1};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  memset(cbuf, 0, sizeof(cbuf));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+  if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1) goto fail;
+
+  close(mfd);
+  setup_views(c);
+  return 0;
+
+fail:;
+  int err = errno;
+  close(mfd);
+  c->sock = -1; // still the caller's
+  shm_close(c);
+  errno = err;
+  return -1;
+}
+
+int shm_attach(shm_conn_t *c, int sock) {
+  memset(c, 0, sizeof(*c));
+  c->side = SHM_CLIENT;
+  c->sock = sock;
+  c->efd[0] = c->efd[1] = -1;
+
+  int fds[3];
+  char cbuf[CMSG_SPACE(sizeof(fds))];
+  char byte;
+  struct iovec iov = {&byte, 1};
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  ssize_t n;
+  while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+  }
+  struct cmsghdr *cm = n == 1 ? CMSG_FIRSTHDR(&msg) : NULL;
+  if (!cm || cm->cmsg_type != SCM_RIGHTS || cm->cmsg_len != CMSG_LEN(sizeof(fds))) {
+    errno = EPROTO;
+    return -1;
+  }
+  memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+  c->efd[SHM_SERVER] = fds[1];
+  c->efd[SHM_CLIENT] = fds[2];
+
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fstat(fds[0], &st) == 0 && (size_t)st.st_size > SHM_DATA_OFF) {
+    c->map_len = (size_t)st.st_size;
+    p = mmap(NULL, c->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+  }
+  close(fds[0]);
+  if (p == MAP_FAILED) {
+    c->sock = -1;
+    shm_close(c);
+    errno = EPROTO;
+    return -1;
+  }
+  c->region = (struct shm_region *)p;
+  if (c->region->magic != SHM_MAGIC ||
+      SHM_DATA_OFF + 2 * c->region->ring_bytes != c->map_len) {
+    c->sock = -1;
+    shm_close(c);
+    errno = EPROTO;
+    return -1;
+  }
+  setup_views(c);
+  return 0;
+}
+
+void shm_close(shm_conn_t *c) {
+  if (c->region) munmap(c->region, c->map_len);
+  c->region = NULL;
+  for (int i = 0; i < 2; i++) {
+    if (c->efd[i] >= 0) close(c->efd[i]);
+    c->efd[i] = -1;
+  }
+  if (c->sock >= 0) close(c->sock);
+  c->sock = -1;
+}
+
+// Pairs with the seq_cst flag store in shm_wait: either the sleeper sees the
+// new counter on its recheck, or this sees its flag and wakes it.
+static void notify(shm_conn_t *c) {
+  int peer = c->side == SHM_SERVER ? SHM_CLIENT : SHM_SERVER;
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&c->region->sleeping[peer], memory_order_relaxed)) {
+    uint64_t one = 1;
+    ssize_t w = write(c->efd[peer], &one, sizeof(one));
+    (void)w; // a full counter already means "wake up"
+  }
+}
+
+// Whether a record of len bytes fits in out; *skip is the padding it needs.
+static int out_room(shm_ring_t *r, size_t len, size_t *skip) {
+  size_t need = rec_size(len);
+  size_t off = (size_t)(r->pos & (r->cap - 1));
+  *skip = off + need > r->cap ? r->cap - off : 0;
+  if (r->pos + *skip + need - r->peer <= r->cap) return 1;
+  r->peer = atomic_load(&r->ctl->tail);
+  return r->pos + *skip + need - r->peer <= r->cap;
+}
+
+static int in_ready(shm_ring_t *r) {
+  if (r->pos != r->peer) return 1;
+  r->peer = atomic_load(&r->ctl->head);
+  return r->pos != r->peer;
+}
+
+void *shm_reserve(shm_conn_t *c, size_t len) {
+  shm_ring_t *r = &c->out;
+  size_t skip;
+  if (len > shm_record_max(r) || !out_room(r, len, &skip)) return NULL;
+  if (skip) *(uint32_t *)(r->data + (r->pos & (r->cap - 1))) = SHM_PAD;
+  r->skip = skip;
+  return r->data + ((r->pos + skip) & (r->cap - 1)) + SHM_HDR;
+}
+
+void shm_commit(shm_conn_t *c, size_t len) {
+  shm_ring_t *r = &c->out;
+  *(uint32_t *)(r->data + ((r->pos + r->skip) & (r->cap - 1))) = (uint32_t)len;
+  r->pos += r->skip + rec_size(len);
+  atomic_store_explicit(&r->ctl->head, r->pos, memory_order_release);
+  notify(c);
+}
+
+const void *shm_peek(shm_conn_t *c, size_t *len) {
+  shm_ring_t *r = &c->in;
+  while (in_ready(r)) {
+    // The peer's memory is not to be trusted with our bounds: a head behind
+    // our tail (or a padding skip past it) wraps avail around.
+    uint64_t avail = r->peer - r->pos;
+    if (avail > r->cap) {
+      c->broken = 1;
+      return NULL;
+    }
+    unsigned char *rec = r->data + (r->pos & (r->cap - 1));
+    uint32_t n = *(const uint32_t *)rec;
+    if (n == SHM_PAD) {
+      r->pos += r->cap - (r->pos & (r->cap - 1));
+      continue;
+    }
+    if (n > shm_record_max(r) || rec_size(n) > avail ||
+        (r->pos & (r->cap - 1)) + rec_size(n) > r->cap) {
+      c->broken = 1;
+      return NULL;
+    }
+    r->cur = rec_size(n);
+    *len = n;
+    return rec + SHM_HDR;
+  }
+  return NULL;
+}
+
+void shm_release(shm_conn_t *c) {
+  shm_ring_t *r = &c->in;
+  r->pos += r->cur;
+  r->cur = 0;
+  atomic_store_explicit(&r->ctl->tail, r->pos, memory_order_release);
+  notify(c);
+}
+
+static int ready(shm_conn_t *c, size_t space) {
+  size_t skip;
+  return space ? out_room(&c->out, space, &skip) : in_ready(&c->in);
+}
+
+// On a single CPU the peer cannot make progress while we spin.
+static int spin_budget(void) {
+  static _Atomic int budget = -1;
+  int b = atomic_load_explicit(&budget, memory_order_relaxed);
+  if (b < 0) {
+    b = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN : 0;
+    atomic_store_explicit(&budget, b, memory_order_relaxed);
+  }
+  return b;
+}
+
+int shm_wait(shm_conn_t *c, size_t space) {
+  if (c->broken) return -1;
+  for (int i = 0, n = spin_budget(); i < n; i++) {
+    if (ready(c, space)) return 0;
+    cpu_relax();
+  }
+
+  int self = c->side;
+  int rc = 0;
+  atomic_store(&c->region->sleeping[self], 1);
+  while (!ready(c, space)) {
+    struct pollfd p[2] = {{c->efd[self], POLLIN, 0}, {c->sock, POLLIN, 0}};
+    if (poll(p, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      rc = -1;
+      break;
+    }
+    // Nothing is ever sent on the session socket after the offer, so any
+    // event on it is the peer going away.
+    if (p[1].revents) {
+      rc = -1;
+      break;
+    }
+    uint64_t v;
+    ssize_t r = read(c->efd[self], &v, sizeof(v));
+    (void)r;
+  }
+  atomic_store(&c->region->sleeping[self], 0);
+  return rc;
+}
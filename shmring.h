@@ -0,0 +1,80 @@
+// shmring.h
+// Shared-memory transport for clients on the same host. A session is one
+// memfd holding two single-producer single-consumer rings, requests
+// (client -> server) and responses (server -> client), of length-prefixed
+// records so message boundaries survive. Each side writes its records in
+// place and reads the other's in place: no syscall and no kernel copy per
+// message. A side with nothing to do spins briefly, then sleeps on its
+// eventfd; the peer only writes that eventfd while the sleeping flag is up.
+//
+// Sessions start on a Unix domain socket: the server creates the region and
+// both eventfds and passes them over with SCM_RIGHTS. The socket stays open
+// for the session's lifetime; its hangup tells either side the other is gone.
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_RING_DEFAULT (1 << 20) // bytes per direction
+#define SHM_RING_MIN 4096
+
+typedef enum { SHM_SERVER = 0, SHM_CLIENT = 1 } shm_side_t;
+
+struct shm_region;
+struct shm_ctl;
+
+// One direction as seen from one side. Producer and consumer each keep a
+// private copy of the other's counter and only re-read the shared one when
+// the copy says the ring is full (or empty).
+typedef struct {
+  struct shm_ctl *ctl;
+  unsigned char *data;
+  size_t cap;       // power of two
+  uint64_t pos;     // own counter: head for the producer, tail for the consumer
+  uint64_t peer;    // last seen value of the other side's counter
+  size_t skip;      // producer: padding before the reserved record
+  size_t cur;       // consumer: bytes of the record handed out by peek
+} shm_ring_t;
+
+typedef struct {
+  struct shm_region *region;
+  size_t map_len;
+  shm_side_t side;
+  shm_ring_t in;  // records from the peer
+  shm_ring_t out; // records to the peer
+  int efd[2];     // wakeups, indexed by shm_side_t
+  int sock;       // session socket, -1 once closed
+  int broken;     // the peer wrote a record header that makes no sense
+} shm_conn_t;
+
+// Largest record a ring of this capacity accepts.
+static inline size_t shm_record_max(const shm_ring_t *r) {
+  return r->cap / 2 - 8;
+}
+
+// Server: creates a session with ring_bytes (a power of two) per direction
+// and sends it down sock. Returns 0, or -1 with errno set.
+int shm_offer(shm_conn_t *c, int sock, size_t ring_bytes);
+
+// Client: receives the session offered on a connected sock.
+int shm_attach(shm_conn_t *c, int sock);
+
+void shm_close(shm_conn_t *c);
+
+// Room for a record of len bytes in c->out, or NULL if the ring is full.
+// The record is published by shm_commit with its final length (<= len).
+void *shm_reserve(shm_conn_t *c, size_t len);
+void shm_commit(shm_conn_t *c, size_t len);
+
+// The oldest record in c->in, or NULL if there is none. It stays valid
+// until shm_release hands its space back to the producer.
+const void *shm_peek(shm_conn_t *c, size_t *len);
+void shm_release(shm_conn_t *c);
+
+// Blocks until c->in has a record (space == 0) or c->out has room for a
+// record of space bytes. Returns 0, or -1 once the peer has hung up.
+int shm_wait(shm_conn_t *c, size_t space);
+
+#endif
@@ -0,0 +1,106 @@
+// sockopt.c
+// Command-line socket tuning, see sockopt.h.
+
+#define _GNU_SOURCE
+#include "sockopt.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+void sockopt_defaults(sockopt_cfg_t *o) {
+  memset(o, 0, sizeof(*o));
+  o->backlog = DEFAULT_BACKLOG;
+}
+
+typedef struct {
+  const char *name; // "--name=" takes a value, "--name" is a switch
+  size_t offset;
+  int min;
+} sockopt_flag_t;
+
+static const sockopt_flag_t sockopt_flags[] = {
+    {"--backlog=", offsetof(sockopt_cfg_t, backlog), 1},
+    {"--nodelay", offsetof(sockopt_cfg_t, nodelay), 0},
+    {"--quickack", offsetof(sockopt_cfg_t, quickack), 0},
+    {"--rcvbuf=", offsetof(sockopt_cfg_t, rcvbuf), 1},
+    {"--sndbuf=", offsetof(sockopt_cfg_t, sndbuf), 1},
+    {"--busy-poll=", offsetof(sockopt_cfg_t, busy_poll), 0},
+    {"--defer-accept=", offsetof(sockopt_cfg_t, defer_accept), 0},
+    {"--fastopen=", offsetof(sockopt_cfg_t, fastopen), 0},
+    {NULL, 0, 0},
+};
+
+int sockopt_parse(sockopt_cfg_t *o, const char *arg) {
+  for (const sockopt_flag_t *f = sockopt_flags; f->name; f++) {
+    size_t len = strlen(f->name);
+    int *field = (int *)((char *)o + f->offset);
+    if (f->name[len - 1] != '=') {
+      if (strcmp(arg, f->name) != 0) continue;
+      *field = 1;
+      return 1;
+    }
+    if (strncmp(arg, f->name, len) != 0) continue;
+
+    char *end;
+    errno = 0;
+    long v = strtol(arg + len, &end, 10);
+    if (errno || end == arg + len || *end || v < f->min || v > (1L << 30)) return -1;
+    *field = (int)v;
+    return 1;
+  }
+  return 0;
+}
+
+static int set_int(int fd, int level, int name, int value) {
+  return setsockopt(fd, level, name, &value, sizeof(value));
+}
+
+// TCP-level options are skipped on Unix domain sockets.
+static int is_tcp(int fd) {
+  int domain;
+  socklen_t len = sizeof(domain);
+  if (getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len) < 0) return 1;
+  return domain == AF_INET || domain == AF_INET6;
+}
+
+const char *sockopt_apply(int fd, const sockopt_cfg_t *o, sock_role_t role) {
+  const char *failed = NULL;
+  int saved = 0;
+#define SOCKOPT_SET(level, name, value)                          \
+  do {                                                           \
+    if (set_int(fd, level, name, value) < 0 && !failed) {        \
+      failed = #name;                                            \
+      saved = errno;                                             \
+    }                                                            \
+  } while (0)
+
+  if (role != ROLE_ACCEPTED) {
+    if (o->rcvbuf) SOCKOPT_SET(SOL_SOCKET, SO_RCVBUF, o->rcvbuf);
+    if (o->sndbuf) SOCKOPT_SET(SOL_SOCKET, SO_SNDBUF, o->sndbuf);
+    if (o->busy_poll) SOCKOPT_SET(SOL_SOCKET, SO_BUSY_POLL, o->busy_poll);
+  }
+  int tcp_opts = o->nodelay || o->quickack || o->defer_accept || o->fastopen;
+  if (role == ROLE_DGRAM || (tcp_opts && !is_tcp(fd))) tcp_opts = 0;
+
+  if (tcp_opts && (role == ROLE_ACCEPTED || role == ROLE_CLIENT)) {
+    if (o->nodelay) SOCKOPT_SET(IPPROTO_TCP, TCP_NODELAY, 1);
+    if (o->quickack) SOCKOPT_SET(IPPROTO_TCP, TCP_QUICKACK, 1);
+  }
+  if (tcp_opts && role == ROLE_LISTENER) {
+    if (o->defer_accept) SOCKOPT_SET(IPPROTO_TCP, TCP_DEFER_ACCEPT, o->defer_accept);
+    if (o->fastopen) SOCKOPT_SET(IPPROTO_TCP, TCP_FASTOPEN, o->fastopen);
+  }
+  if (tcp_opts && role == ROLE_CLIENT && o->fastopen) {
+    // Data handed to the first send() rides on the SYN when a cookie is cached.
+    SOCKOPT_SET(IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1);
+  }
+#undef SOCKOPT_SET
+
+  if (failed) errno = saved;
+  return failed;
+}
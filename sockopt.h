@@ -0,0 +1,44 @@
+// sockopt.h
+// Socket tuning shared by the server and the client: listen backlog,
+// TCP_NODELAY, TCP_QUICKACK, SO_RCVBUF/SO_SNDBUF, SO_BUSY_POLL,
+// TCP_DEFER_ACCEPT and TCP_FASTOPEN, set from the command line
+// (--backlog=N --nodelay --quickack --rcvbuf=BYTES --sndbuf=BYTES
+// --busy-poll=USEC --defer-accept=SEC --fastopen=QLEN). Anything left at 0
+// keeps the kernel default and costs no syscall.
+
+#ifndef SOCKOPT_H
+#define SOCKOPT_H
+
+// The kernel silently clamps this to net.core.somaxconn.
+#define DEFAULT_BACKLOG 4096
+
+typedef struct {
+  int backlog;
+  int nodelay;
+  int quickack;     // not sticky: the kernel may leave quickack mode again later
+  int rcvbuf;       // bytes; fixing a size turns off the kernel's autotuning
+  int sndbuf;
+  int busy_poll;    // microseconds to busy-poll the device queue on a blocking read
+  int defer_accept; // seconds a listener waits for the first data before accept()
+  int fastopen;     // listener: TFO queue length; client: any value enables TFO
+} sockopt_cfg_t;
+
+typedef enum {
+  ROLE_LISTENER, // before listen(); accepted sockets inherit buffers and busy-poll
+  ROLE_ACCEPTED,
+  ROLE_CLIENT,   // before connect(), so buffer sizes shape the window scale
+  ROLE_DGRAM
+} sock_role_t;
+
+void sockopt_defaults(sockopt_cfg_t *o);
+
+// Returns 1 if arg was a socket option (and stores it), 0 if it is not one,
+// -1 if it is one with a bad value.
+int sockopt_parse(sockopt_cfg_t *o, const char *arg);
+
+// Sets the options that apply to a socket in this role. Returns NULL, or the
+// name of the first option the kernel refused with errno set; the remaining
+// options are still applied.
+const char *sockopt_apply(int fd, const sockopt_cfg_t *o, sock_role_t role);
+
+#endif
@@ -0,0 +1,94 @@
+// timerwheel.c
+// Hierarchical timing wheel, see timerwheel.h.
+
+#include "timerwheel.h"
+
+static void list_init(tw_timer_t *head) {
+  head->next = head->prev = head;
+}
+
+static void list_add(tw_timer_t *head, tw_timer_t *t) {
+  t->next = head->next;
+  t->prev = head;
+  head->next->prev = t;
+  head->next = t;
+}
+
+static void list_del(tw_timer_t *t) {
+  t->prev->next = t->next;
+  t->next->prev = t->prev;
+  t->next = t->prev = NULL;
+}
+
+void tw_init(tw_wheel_t *w) {
+  w->now = 0;
+  w->count = 0;
+  for (int l = 0; l < TW_LEVELS; l++) {
+    for (int s = 0; s < TW_SLOTS; s++) list_init(&w->slots[l][s]);
+  }
+}
+
+// Level l holds deadlines less than TW_SLOTS^(l+1) ticks away, in the slot
+// whose index matches the deadline's level-l digit. That slot comes round
+// (and is redistributed) exactly when the deadline is within reach of level l-1.
+static void place(tw_wheel_t *w, tw_timer_t *t) {
+  uint64_t delta = t->expires - w->now;
+  int l = 0;
+  while (l < TW_LEVELS - 1 && delta >= (uint64_t)1 << (TW_BITS * (l + 1))) l++;
+  if (delta >= (uint64_t)1 << (TW_BITS * (l + 1))) {
+    // Beyond the top level: park at its far edge, re-placed when it comes round.
+    t->expires = w->now + ((uint64_t)1 << (TW_BITS * TW_LEVELS)) - 1;
+  }
+  list_add(&w->slots[l][(t->expires >> (TW_BITS * l)) & (TW_SLOTS - 1)], t);
+}
+
+void tw_arm(tw_wheel_t *w, tw_timer_t *t, uint64_t expires) {
+  if (t->next) {
+    list_del(t);
+  } else {
+    w->count++;
+  }
+  t->expires = expires > w->now ? expires : w->now + 1;
+  place(w, t);
+}
+
+void tw_cancel(tw_wheel_t *w, tw_timer_t *t) {
+  if (!t->next) return;
+  list_del(t);
+  w->count--;
+}
+
+static void cascade(tw_wheel_t *w, int l) {
+  tw_timer_t *head = &w->slots[l][(w->now >> (TW_BITS * l)) & (TW_SLOTS - 1)];
+  while (head->next != head) {
+    tw_timer_t *t = head->next;
+    list_del(t);
+    place(w, t);
+  }
+}
+
+void tw_tick(tw_wheel_t *w, void (*fire)(tw_timer_t *t, void *arg), void *arg) {
+  w->now++;
+  for (int l = 1; l < TW_LEVELS; l++) {
+    if ((w->now >> (TW_BITS * (l - 1))) & (TW_SLOTS - 1)) break;
+    cascade(w, l);
+  }
+
+  // Everything on the current level-0 slot is due now; detach the list first
+  // so timers fire() re-arms for a later tick are not seen again.
+  tw_timer_t due;
+  tw_timer_t *head = &w->slots[0][w->now & (TW_SLOTS - 1)];
+  if (head->next == head) return;
+  due.next = head->next;
+  due.prev = head->prev;
+  due.next->prev = &due;
+  due.prev->next = &due;
+  list_init(head);
+
+  while (due.next != &due) {
+    tw_timer_t *t = due.next;
+    list_del(t);
+    w->count--;
+    fire(t, arg);
+  }
+}
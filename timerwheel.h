@@ -0,0 +1,45 @@
+// timerwheel.h
+// Hierarchical timing wheel for per-connection timeouts: TW_LEVELS wheels of
+// TW_SLOTS slots, a slot on level l spanning TW_SLOTS^l ticks. Timers are
+// intrusive list nodes, so arming and cancelling are O(1) pointer swaps; a
+// tick looks at one level-0 slot and, once every TW_SLOTS ticks, spreads one
+// slot of the level above over the levels below. Nothing ever scans the
+// armed timers, however many there are.
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TW_BITS 6
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_LEVELS 4 // 2^24 ticks ahead; later deadlines wait on the last level
+
+typedef struct tw_timer {
+  struct tw_timer *next; // NULL while not armed
+  struct tw_timer *prev;
+  uint64_t expires;      // absolute tick
+} tw_timer_t;
+
+typedef struct {
+  uint64_t now;          // ticks since tw_init
+  size_t count;          // armed timers
+  tw_timer_t slots[TW_LEVELS][TW_SLOTS]; // list heads
+} tw_wheel_t;
+
+void tw_init(tw_wheel_t *w);
+
+static inline int tw_armed(const tw_timer_t *t) {
+  return t->next != NULL;
+}
+
+// (Re)arms t to fire at tick expires; a deadline already due fires on the next tick.
+void tw_arm(tw_wheel_t *w, tw_timer_t *t, uint64_t expires);
+void tw_cancel(tw_wheel_t *w, tw_timer_t *t);
+
+// Advances one tick and calls fire() for every timer due, already disarmed.
+// fire may arm or cancel any timer, including the one it was given.
+void tw_tick(tw_wheel_t *w, void (*fire)(tw_timer_t *t, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,117 @@
+// topology.c
+// sysfs topology and mbind placement, see topology.h.
+
+#define _GNU_SOURCE
+#include "topology.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define MAX_NODES 1024
+
+// "0-3,8,10-11" as written by the kernel for cpulists and node lists.
+static int parse_list(const char *s, cpu_set_t *set) {
+  int n = 0;
+  while (*s && *s != '\n') {
+    char *end;
+    long lo = strtol(s, &end, 10), hi = lo;
+    if (end == s) return -1;
+    if (*end == '-') hi = strtol(end + 1, &end, 10);
+    for (long c = lo; c <= hi && c < CPU_SETSIZE; c++) {
+      CPU_SET((int)c, set);
+      n++;
+    }
+    s = *end == ',' ? end + 1 : end;
+  }
+  return n;
+}
+
+static int read_list(const char *path, cpu_set_t *set) {
+  char buf[4096];
+  FILE *f = fopen(path, "r");
+  if (!f) return -1;
+  int n = fgets(buf, sizeof(buf), f) ? parse_list(buf, set) : -1;
+  fclose(f);
+  return n;
+}
+
+int topo_nodes(void) {
+  static int nodes;
+  if (nodes == 0) {
+    cpu_set_t set; // reused as a plain bitmap of node ids
+    CPU_ZERO(&set);
+    int n = read_list("/sys/devices/system/node/online", &set);
+    nodes = n > 0 ? n : 1;
+  }
+  return nodes;
+}
+
+int topo_cpu_node(int cpu) {
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  DIR *d = opendir(path);
+  if (!d) return -1;
+  int node = -1;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    if (strncmp(e->d_name, "node", 4) == 0 && e->d_name[4] >= '0' && e->d_name[4] <= '9') {
+      node = atoi(e->d_name + 4);
+      break;
+    }
+  }
+  closedir(d);
+  return node;
+}
+
+int topo_nic_cpus(const char *ifname, cpu_set_t *set) {
+  char path[256];
+  CPU_ZERO(set);
+  snprintf(path, sizeof(path), "/sys/class/net/%s/device/local_cpulist", ifname);
+  int n = read_list(path, set);
+  if (n > 0) return n;
+
+  // No node information (or a board that reports none): follow the IRQs.
+  snprintf(path, sizeof(path), "/sys/class/net/%s/device/msi_irqs", ifname);
+  DIR *d = opendir(path);
+  if (!d) return -1;
+  struct dirent *e;
+  while ((e = readdir(d)) != NULL) {
+    if (e->d_name[0] < '0' || e->d_name[0] > '9') continue;
+    snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", atoi(e->d_name));
+    read_list(path, set);
+  }
+  closedir(d);
+  n = CPU_COUNT(set);
+  return n > 0 ? n : -1;
+}
+
+int topo_bind(void *p, size_t len, int node) {
+  if (node < 0 || node >= MAX_NODES || topo_nodes() < 2) return 0;
+  unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+  mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+  // Preferred rather than bound: a full node spills over instead of failing.
+  return (int)syscall(SYS_mbind, p, len, MPOL_PREFERRED, mask, (unsigned long)MAX_NODES, 0);
+}
+
+void *topo_alloc(size_t len, int node) {
+  void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) return NULL;
+  if (topo_bind(p, len, node) < 0) {
+    int err = errno;
+    munmap(p, len);
+    errno = err;
+    return NULL;
+  }
+  return p;
+}
+
+void topo_free(void *p, size_t len) {
+  if (p) munmap(p, len);
+}
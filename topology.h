@@ -0,0 +1,32 @@
+// topology.h
+// CPU, NUMA node and NIC placement read from sysfs, and node-local memory
+// through the mbind system call, so the server needs no libnuma. On a
+// single-node machine every call degrades to plain allocation.
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <sched.h> // cpu_set_t, needs _GNU_SOURCE
+#include <stddef.h>
+
+// Online NUMA nodes (1 when sysfs says nothing).
+int topo_nodes(void);
+
+// Node of an online CPU, or -1 if unknown.
+int topo_cpu_node(int cpu);
+
+// CPUs local to a network interface: the node the device sits on, or failing
+// that the CPUs its interrupts are routed to. Returns how many, or -1 when
+// sysfs has no device behind the name (loopback, veth, tunnels).
+int topo_nic_cpus(const char *ifname, cpu_set_t *set);
+
+// Prefers node for the pages of [p, p + len), which must not have been
+// touched yet; later faults then land there while it has memory free. A no-op
+// for node < 0 or on one node. Returns 0, or -1 with errno set.
+int topo_bind(void *p, size_t len, int node);
+
+// Anonymous mmap bound to node, zero-filled; NULL on failure.
+void *topo_alloc(size_t len, int node);
+void topo_free(void *p, size_t len);
+
+#endif
@@ -0,0 +1,213 @@
+// trace.c
+// Ring registry and writer thread for trace.h (make TRACE=1 only).
+//
+// A ring stays with its thread until the thread exits; the thread-local
+// destructor then retires it, and once the writer has drained a retired ring
+// it becomes free for the next new thread, so short-lived blocking-engine
+// threads do not each cost 1 MB. The owner never waits for the writer: if
+// the writer falls a full ring behind, the oldest events are overwritten,
+// and the writer counts what it lost in the block it writes next. It checks
+// head again after copying, because an event may have been overwritten while
+// it was being copied.
+//
+// File layout, native endianness: a trace_file_header_t, then any number of
+// blocks, each a trace_block_t followed by its count trace_event_t records.
+
+#define _GNU_SOURCE
+#include "trace.h"
+#include "tracefile.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define TRACE_MAX_RINGS 4096
+#define TRACE_POLL_MS 10
+
+enum { TRACE_RING_ACTIVE, TRACE_RING_RETIRED, TRACE_RING_FREE };
+
+int g_trace_on;
+__thread trace_ring_t *t_trace_ring;
+static __thread int t_trace_failed;
+
+static pthread_mutex_t g_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_ring_t *g_rings[TRACE_MAX_RINGS];
+static int g_nrings;
+static pthread_key_t g_ring_key;
+
+static int g_fd = -1;
+static int g_on_signal;
+static trace_event_t g_copy[TRACE_RING];
+
+static void ring_retire(void *arg) {
+  trace_ring_t *r = (trace_ring_t *)arg;
+  atomic_store_explicit(&r->state, TRACE_RING_RETIRED, memory_order_release);
+}
+
+trace_ring_t *trace_ring_attach(void) {
+  if (t_trace_failed) return NULL;
+  trace_ring_t *r = NULL;
+  pthread_mutex_lock(&g_rings_lock);
+  for (int i = 0; i < g_nrings; i++) {
+    if (atomic_load_explicit(&g_rings[i]->state, memory_order_acquire) == TRACE_RING_FREE) {
+      r = g_rings[i];
+      break;
+    }
+  }
+  if (!r && g_nrings < TRACE_MAX_RINGS) {
+    r = (trace_ring_t *)calloc(1, sizeof(*r));
+    if (r) g_rings[g_nrings++] = r;
+  }
+  if (r) {
+    // head and tail carry on from the previous owner, already drained.
+    r->tid = (uint32_t)syscall(SYS_gettid);
+    atomic_store_explicit(&r->state, TRACE_RING_ACTIVE, memory_order_release);
+  }
+  pthread_mutex_unlock(&g_rings_lock);
+
+  if (!r) {
+    t_trace_failed = 1;
+    return NULL;
+  }
+  pthread_setspecific(g_ring_key, r);
+  t_trace_ring = r;
+  return r;
+}
+
+static int write_all(const void *buf, size_t len) {
+  const char *p = (const char *)buf;
+  while (len > 0) {
+    ssize_t n = write(g_fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+// Moves everything r holds past tail to the file.
+static int drain_ring(trace_ring_t *r, uint32_t tid) {
+  uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+  uint64_t from = r->tail;
+  if (head - from > TRACE_RING) from = head - TRACE_RING;
+  if (from == head) return 0;
+
+  for (uint64_t i = from; i < head; i++) g_copy[i - from] = r->ev[i & (TRACE_RING - 1)];
+  // Whatever the owner wrote meanwhile may have replaced the first copies.
+  uint64_t now = atomic_load_explicit(&r->head, memory_order_acquire);
+  uint64_t skip = 0;
+  if (now - from > TRACE_RING) skip = now - from - TRACE_RING;
+  if (skip > head - from) skip = head - from;
+
+  trace_block_t blk = {
+      .tid = tid,
+      .count = (uint32_t)(head - from - skip),
+      .dropped = (from - r->tail) + skip,
+  };
+  r->tail = head;
+  if (blk.count == 0 && blk.dropped == 0) return 0;
+  if (write_all(&blk, sizeof(blk)) < 0) return -1;
+  return write_all(g_copy + skip, blk.count * sizeof(trace_event_t));
+}
+
+static int drain_all(void) {
+  pthread_mutex_lock(&g_rings_lock);
+  int n = g_nrings;
+  pthread_mutex_unlock(&g_rings_lock);
+
+  for (int i = 0; i < n; i++) {
+    trace_ring_t *r = g_rings[i];
+    pthread_mutex_lock(&g_rings_lock);
+    int state = atomic_load_explicit(&r->state, memory_order_acquire);
+    uint32_t tid = r->tid;
+    pthread_mutex_unlock(&g_rings_lock);
+    if (state == TRACE_RING_FREE) continue;
+
+    if (drain_ring(r, tid) < 0) return -1;
+    if (state == TRACE_RING_RETIRED) {
+      // The owner is gone, so nothing can follow what was just written.
+      atomic_store_explicit(&r->state, TRACE_RING_FREE, memory_order_release);
+    }
+  }
+  return 0;
+}
+
+// Converts the clock to seconds for trace2json: the TSC rate, measured here
+// against CLOCK_MONOTONIC, or 1e9 where the clock already is nanoseconds.
+static uint64_t clock_rate(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  struct timespec t0, t1, nap = {0, 20 * 1000 * 1000};
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  uint64_t c0 = trace_clock();
+  nanosleep(&nap, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  uint64_t c1 = trace_clock();
+  uint64_t ns = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000ULL + (uint64_t)t1.tv_nsec -
+                (uint64_t)t0.tv_nsec;
+  return ns ? (c1 - c0) * 1000000000ULL / ns : 1;
+#else
+  return 1000000000ULL;
+#endif
+}
+
+static void *writer_thread(void *arg) {
+  (void)arg;
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR2);
+  struct timespec poll = {0, TRACE_POLL_MS * 1000 * 1000};
+
+  while (1) {
+    if (g_on_signal) {
+      int sig;
+      if (sigwait(&set, &sig) != 0) continue;
+    } else if (sigtimedwait(&set, NULL, &poll) < 0 && errno != EAGAIN) {
+      continue;
+    }
+    if (drain_all() < 0) {
+      perror("[server] trace write");
+      g_trace_on = 0;
+      return NULL;
+    }
+    if (g_on_signal) fprintf(stderr, "[server] trace written\n");
+  }
+  return NULL;
+}
+
+int trace_start(const char *path, int on_signal) {
+  if (pthread_key_create(&g_ring_key, ring_retire) != 0) return -1;
+  g_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (g_fd < 0) return -1;
+
+  trace_file_header_t hdr = {.ticks_per_sec = clock_rate(), .pid = (uint32_t)getpid()};
+  memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+  if (write_all(&hdr, sizeof(hdr)) < 0) return -1;
+
+  // Blocked here, so every thread started later has it blocked too and the
+  // signal goes to the writer's sigwait.
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  g_on_signal = on_signal;
+  g_trace_on = 1;
+  pthread_t tid;
+  int err = pthread_create(&tid, NULL, writer_thread, NULL);
+  if (err != 0) {
+    g_trace_on = 0;
+    errno = err;
+    return -1;
+  }
+  pthread_detach(tid);
+  return 0;
+}
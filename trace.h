@@ -0,0 +1,78 @@
+// trace.h
+// Per-message lifecycle tracing for tail-latency work: accept, read,
+// transform begin/end, send, EAGAIN and close, each stamped with the TSC and
+// the socket. Only in make TRACE=1 builds (-DECHO_TRACE); otherwise TRACE()
+// expands to nothing, arguments included, and trace.c is not linked.
+//
+// Every thread appends to its own ring with an ordinary load and store, no
+// atomic read-modify-write and no lock. One writer thread moves the rings to
+// a binary file, either continuously or only when SIGUSR2 arrives (then the
+// rings are a flight recorder of the last TRACE_RING events per thread);
+// trace2json turns the file into Chrome / Perfetto JSON.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef ECHO_TRACE
+
+#include "tracefile.h"
+
+#include <stdatomic.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define TRACE_RING (1 << 16) // events per thread, 1 MB
+
+// Owned by one thread at a time; the writer thread reads behind it.
+typedef struct trace_ring {
+  _Atomic uint64_t head;   // events ever written, stored by the owner only
+  _Atomic int state;       // TRACE_RING_* in trace.c
+  uint64_t tail;           // writer thread: events already moved to the file
+  uint32_t tid;
+  trace_event_t ev[TRACE_RING];
+} trace_ring_t;
+
+extern int g_trace_on;
+extern __thread trace_ring_t *t_trace_ring;
+
+// The calling thread's ring, set up on first use; NULL if none is left.
+trace_ring_t *trace_ring_attach(void);
+
+static inline uint64_t trace_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline void trace_event(trace_kind_t kind, int fd, uint64_t arg) {
+  if (!g_trace_on) return;
+  trace_ring_t *r = t_trace_ring ? t_trace_ring : trace_ring_attach();
+  if (!r) return;
+  uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  trace_event_t *e = &r->ev[head & (TRACE_RING - 1)];
+  e->tsc = trace_clock();
+  e->fd = fd;
+  e->kind_arg = ((uint32_t)kind << TRACE_KIND_SHIFT) |
+                (arg > TRACE_ARG_MAX ? TRACE_ARG_MAX : (uint32_t)arg);
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+// Starts recording and the writer thread; blocks SIGUSR2 in the caller, so
+// call it before any other thread exists. Returns 0, or -1 with errno set.
+int trace_start(const char *path, int on_signal);
+
+#define TRACE(kind, fd, arg) trace_event((kind), (fd), (uint64_t)(arg))
+
+#else
+
+#define TRACE(kind, fd, arg) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,92 @@
+// trace2json.c
+// Converts a server --trace file to the Chrome trace event format, which
+// chrome://tracing and ui.perfetto.dev open directly. Each server thread is a
+// track; transforms are slices, everything else instant events carrying the
+// socket and byte count. Times are microseconds from the first event.
+//
+//   trace2json server.trace > server.json
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracefile.h"
+
+static const char *kind_names[TR_KINDS] = {
+    [TR_ACCEPT] = "accept", [TR_READ] = "read",   [TR_XFORM_BEGIN] = "transform",
+    [TR_XFORM_END] = "transform", [TR_SEND] = "send", [TR_EAGAIN] = "eagain",
+    [TR_CLOSE] = "close",
+};
+
+typedef struct {
+  uint32_t tid;
+  trace_event_t ev;
+} record_t;
+
+static void die(const char *msg) {
+  fprintf(stderr, "trace2json: %s\n", msg);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s TRACE_FILE > OUT.json\n", argv[0]);
+    return 2;
+  }
+  FILE *in = fopen(argv[1], "rb");
+  if (!in) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  trace_file_header_t hdr;
+  if (fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0) {
+    die("not a server trace file");
+  }
+  if (hdr.ticks_per_sec == 0) die("trace file has no clock rate");
+
+  // Blocks of different threads interleave, so collect everything first to
+  // find the earliest timestamp.
+  record_t *recs = NULL;
+  size_t n = 0, cap = 0;
+  uint64_t dropped = 0, base = UINT64_MAX;
+  trace_block_t blk;
+  while (fread(&blk, sizeof(blk), 1, in) == 1) {
+    dropped += blk.dropped;
+    for (uint32_t i = 0; i < blk.count; i++) {
+      if (n == cap) {
+        cap = cap ? cap * 2 : 65536;
+        recs = (record_t *)realloc(recs, cap * sizeof(*recs));
+        if (!recs) die("out of memory");
+      }
+      if (fread(&recs[n].ev, sizeof(trace_event_t), 1, in) != 1) die("truncated trace file");
+      recs[n].tid = blk.tid;
+      if (recs[n].ev.tsc < base) base = recs[n].ev.tsc;
+      n++;
+    }
+  }
+  fclose(in);
+
+  double us_per_tick = 1e6 / (double)hdr.ticks_per_sec;
+  printf("{\"traceEvents\":[\n");
+  for (size_t i = 0; i < n; i++) {
+    const trace_event_t *e = &recs[i].ev;
+    unsigned kind = e->kind_arg >> TRACE_KIND_SHIFT;
+    unsigned arg = e->kind_arg & TRACE_ARG_MAX;
+    if (kind >= TR_KINDS) die("unknown event kind");
+    const char *ph = kind == TR_XFORM_BEGIN ? "B" : kind == TR_XFORM_END ? "E" : "i";
+    const char *key = kind == TR_EAGAIN ? "write" : "bytes";
+    printf("{\"name\":\"%s\",\"ph\":\"%s\",%s\"ts\":%.3f,\"pid\":%u,\"tid\":%u,"
+           "\"args\":{\"fd\":%d,\"%s\":%u}}%s\n",
+           kind_names[kind], ph, *ph == 'i' ? "\"s\":\"t\"," : "",
+           (double)(e->tsc - base) * us_per_tick, hdr.pid, recs[i].tid, (int)e->fd, key, arg,
+           i + 1 < n ? "," : "");
+  }
+  printf("],\"displayTimeUnit\":\"ns\"}\n");
+
+  fprintf(stderr, "trace2json: %zu events", n);
+  if (dropped) fprintf(stderr, ", %llu overwritten before they were written out", (unsigned long long)dropped);
+  fprintf(stderr, "\n");
+  free(recs);
+  return 0;
+}
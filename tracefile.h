@@ -0,0 +1,48 @@
+// tracefile.h
+// What the server's tracer writes and trace2json reads: the event record and
+// the layout of the trace file (see trace.c). Native endianness throughout,
+// the file is meant to be converted on the host that wrote it.
+
+#ifndef TRACEFILE_H
+#define TRACEFILE_H
+
+#include <stdint.h>
+
+typedef enum {
+  TR_ACCEPT,
+  TR_READ,         // arg: bytes
+  TR_XFORM_BEGIN,  // arg: bytes in; fd -1, the transform runs on the buffer
+  TR_XFORM_END,    // arg: bytes out
+  TR_SEND,         // arg: bytes
+  TR_EAGAIN,       // arg: 0 for a read, 1 for a write
+  TR_CLOSE,
+  TR_KINDS
+} trace_kind_t;
+
+#define TRACE_KIND_SHIFT 28
+#define TRACE_ARG_MAX ((1u << TRACE_KIND_SHIFT) - 1)
+
+typedef struct {
+  uint64_t tsc;
+  int32_t fd;
+  uint32_t kind_arg; // kind in the top 4 bits, arg (saturated) below
+} trace_event_t;
+
+#define TRACE_MAGIC "ECHOTRC1"
+
+typedef struct {
+  char magic[8];
+  uint64_t ticks_per_sec; // trace_event_t.tsc units
+  uint32_t pid;
+  uint32_t reserved;
+} trace_file_header_t;
+
+// Followed by count events of thread tid, oldest first; dropped events were
+// overwritten before the writer got to them and came before these.
+typedef struct {
+  uint32_t tid;
+  uint32_t count;
+  uint64_t dropped;
+} trace_block_t;
+
+#endif
@@ -0,0 +1,288 @@
+// transform.c
+// ASCII uppercase kernels + runtime CPU dispatch, and the transform stage registry.
+// Every SIMD kernel flips bit 0x20 on bytes in 'a'..'z' and leaves all other
+// bytes alone, which is exactly toupper() in the default "C" locale.
+
+#include "transform.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UPPER_X86 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define UPPER_NEON 1
+#endif
+
+static void upper_locale(unsigned char *buf, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    buf[i] = (unsigned char)toupper((unsigned char)buf[i]);
+  }
+}
+
+static void upper_scalar(unsigned char *buf, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = buf[i];
+    if ((unsigned char)(c - 'a') < 26) buf[i] = (unsigned char)(c ^ 0x20);
+  }
+}
+
+#ifdef UPPER_X86
+// Shift 'a'..'z' to the bottom of the signed range so one signed compare
+// selects them: (c + (0x80 - 'a')) < -128 + 26. The target attribute lets
+// i386 builds without -msse2 compile it; dispatch only picks it on SSE2 CPUs.
+__attribute__((target("sse2")))
+static void upper_sse2(unsigned char *buf, size_t n) {
+  const __m128i shift = _mm_set1_epi8((char)(0x80 - 'a'));
+  const __m128i limit = _mm_set1_epi8((char)(-128 + 26));
+  const __m128i flip = _mm_set1_epi8(0x20);
+  size_t i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+    __m128i lower = _mm_cmplt_epi8(_mm_add_epi8(v, shift), limit);
+    v = _mm_xor_si128(v, _mm_and_si128(lower, flip));
+    _mm_storeu_si128((__m128i *)(buf + i), v);
+  }
+  upper_scalar(buf + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void upper_avx2(unsigned char *buf, size_t n) {
+  const __m256i shift = _mm256_set1_epi8((char)(0x80 - 'a'));
+  const __m256i limit = _mm256_set1_epi8((char)(-128 + 26));
+  const __m256i flip = _mm256_set1_epi8(0x20);
+  size_t i = 0;
+
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+    __m256i lower = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(v, shift));
+    v = _mm256_xor_si256(v, _mm256_and_si256(lower, flip));
+    _mm256_storeu_si256((__m256i *)(buf + i), v);
+  }
+  upper_sse2(buf + i, n - i);
+}
+#endif
+
+#ifdef UPPER_NEON
+static void upper_neon(unsigned char *buf, size_t n) {
+  const uint8x16_t a = vdupq_n_u8('a');
+  const uint8x16_t range = vdupq_n_u8(26);
+  const uint8x16_t flip = vdupq_n_u8(0x20);
+  size_t i = 0;
+
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t v = vld1q_u8(buf + i);
+    uint8x16_t lower = vcltq_u8(vsubq_u8(v, a), range);
+    vst1q_u8(buf + i, veorq_u8(v, vandq_u8(lower, flip)));
+  }
+  upper_scalar(buf + i, n - i);
+}
+#endif
+
+static upper_kernel_t g_kernels[] = {
+    {"locale", upper_locale, 1},
+    {"scalar", upper_scalar, 1},
+#ifdef UPPER_X86
+    {"sse2", upper_sse2, 0},
+    {"avx2", upper_avx2, 0},
+#endif
+#ifdef UPPER_NEON
+    {"neon", upper_neon, 1},
+#endif
+    {NULL, NULL, 0}};
+
+upper_fn_t g_upper_fn = upper_locale;
+static const char *g_upper_name = "locale";
+
+static void upper_detect(void) {
+#ifdef UPPER_X86
+  __builtin_cpu_init();
+  for (upper_kernel_t *k = g_kernels; k->name; k++) {
+    if (k->fn == upper_sse2) k->supported = __builtin_cpu_supports("sse2");
+    if (k->fn == upper_avx2) k->supported = __builtin_cpu_supports("avx2");
+  }
+#endif
+}
+
+void upper_init(int strict_locale) {
+  upper_detect();
+  if (strict_locale) {
+    g_upper_fn = upper_locale;
+    g_upper_name = "locale";
+    return;
+  }
+
+  // Later entries are faster; take the last one the CPU supports.
+  for (const upper_kernel_t *k = g_kernels + 1; k->name; k++) {
+    if (k->supported) {
+      g_upper_fn = k->fn;
+      g_upper_name = k->name;
+    }
+  }
+}
+
+const char *upper_kernel_name(void) {
+  return g_upper_name;
+}
+
+const upper_kernel_t *upper_kernels(void) {
+  upper_detect();
+  return g_kernels;
+}
+
+// ---- stages ----
+
+static void stage_upper(unsigned char *buf, size_t n, stage_state_t *st) {
+  (void)st;
+  to_uppercase(buf, n);
+}
+
+static void stage_lower(unsigned char *buf, size_t n, stage_state_t *st) {
+  (void)st;
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = buf[i];
+    if ((unsigned char)(c - 'A') < 26) buf[i] = (unsigned char)(c | 0x20);
+  }
+}
+
+static void stage_rot13(unsigned char *buf, size_t n, stage_state_t *st) {
+  (void)st;
+  for (size_t i = 0; i < n; i++) {
+    unsigned char c = buf[i];
+    unsigned char base = (unsigned char)(c & 0x20) | 'A'; // 'A' or 'a'
+    unsigned char off = (unsigned char)(c - base);
+    if (off < 26) buf[i] = (unsigned char)(base + (off + 13) % 26);
+  }
+}
+
+// CRC-32 (IEEE 802.3), appended as ":xxxxxxxx".
+static uint32_t g_crc_table[256];
+
+static void crc_table_init(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    g_crc_table[i] = c;
+  }
+}
+
+static void stage_checksum(unsigned char *buf, size_t n, stage_state_t *st) {
+  uint32_t crc = st->crc;
+  for (size_t i = 0; i < n; i++) crc = g_crc_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+  st->crc = crc;
+}
+
+static void stage_checksum_finish(stage_state_t *st, unsigned char *out) {
+  static const char hex[] = "0123456789abcdef";
+  uint32_t crc = ~st->crc;
+  out[0] = ':';
+  for (int i = 0; i < 8; i++) out[1 + i] = (unsigned char)hex[(crc >> (28 - 4 * i)) & 0xf];
+}
+
+static const transform_stage_t g_stages[] = {
+    {"echo", NULL, 0, NULL},
+    {"upper", stage_upper, 0, NULL},
+    {"lower", stage_lower, 0, NULL},
+    {"rot13", stage_rot13, 0, NULL},
+    {"checksum", stage_checksum, 9, stage_checksum_finish},
+};
+#define NSTAGES_REGISTERED (sizeof(g_stages) / sizeof(g_stages[0]))
+
+const char *transform_stage_names(void) {
+  static char names[128];
+  if (!names[0]) {
+    size_t off = 0;
+    for (size_t i = 0; i < NSTAGES_REGISTERED; i++) {
+      off += (size_t)snprintf(names + off, sizeof(names) - off, "%s%s", i ? "," : "",
+                              g_stages[i].name);
+    }
+  }
+  return names;
+}
+
+int transform_chain_parse(transform_chain_t *chain, const char *spec, char *bad, size_t bad_len) {
+  if (!g_crc_table[1]) crc_table_init();
+  memset(chain, 0, sizeof(*chain));
+
+  const char *p = spec;
+  while (*p) {
+    const char *end = strchr(p, ',');
+    size_t len = end ? (size_t)(end - p) : strlen(p);
+
+    const transform_stage_t *found = NULL;
+    for (size_t i = 0; i < NSTAGES_REGISTERED; i++) {
+      if (strlen(g_stages[i].name) == len && strncmp(g_stages[i].name, p, len) == 0) {
+        found = &g_stages[i];
+        break;
+      }
+    }
+    if (!found || chain->nstages == MAX_STAGES) {
+      if (bad) snprintf(bad, bad_len, "%.*s", (int)len, p);
+      return -1;
+    }
+    // "echo" is the identity; it only exists so a chain can be spelled out.
+    if (found->apply || found->trailer_len) {
+      chain->stages[chain->nstages++] = found;
+      chain->trailer_len += found->trailer_len;
+    }
+
+    if (!end) break;
+    p = end + 1;
+  }
+  return 0;
+}
+
+void transform_chain_describe(const transform_chain_t *chain, char *out, size_t len) {
+  size_t off = 0;
+  out[0] = '\0';
+  if (chain->nstages == 0) {
+    snprintf(out, len, "echo");
+    return;
+  }
+  for (int i = 0; i < chain->nstages && off < len; i++) {
+    int w = snprintf(out + off, len - off, "%s%s", i ? "," : "", chain->stages[i]->name);
+    if (w < 0) break;
+    off += (size_t)w;
+  }
+}
+
+void transform_begin(const transform_chain_t *chain, transform_state_t *ts) {
+  for (int i = 0; i < chain->nstages; i++) ts->st[i].crc = 0xffffffffu;
+}
+
+static void chain_run(const transform_chain_t *chain, transform_state_t *ts, int first,
+                      unsigned char *buf, size_t n) {
+  for (int i = first; i < chain->nstages; i++) {
+    if (chain->stages[i]->apply) chain->stages[i]->apply(buf, n, &ts->st[i]);
+  }
+}
+
+void transform_update(const transform_chain_t *chain, transform_state_t *ts,
+                      unsigned char *buf, size_t n) {
+  chain_run(chain, ts, 0, buf, n);
+}
+
+// A trailer produced by stage i is still input to stages i+1.., so
+// "checksum,upper" uppercases the hex digits too.
+void transform_finish(const transform_chain_t *chain, transform_state_t *ts, unsigned char *out) {
+  size_t off = 0;
+  for (int i = 0; i < chain->nstages; i++) {
+    const transform_stage_t *stage = chain->stages[i];
+    if (!stage->trailer_len) continue;
+    stage->finish(&ts->st[i], out + off);
+    chain_run(chain, ts, i + 1, out + off, stage->trailer_len);
+    off += stage->trailer_len;
+  }
+}
+
+size_t transform_apply(const transform_chain_t *chain, unsigned char *buf, size_t n) {
+  transform_state_t ts;
+  transform_begin(chain, &ts);
+  transform_update(chain, &ts, buf, n);
+  transform_finish(chain, &ts, buf + n);
+  return n + chain->trailer_len;
+}
@@ -0,0 +1,80 @@
+// transform.h
+// Byte transforms applied by the server before echoing data back.
+// to_uppercase() dispatches to the fastest ASCII kernel the CPU supports
+// (AVX2 / SSE2 / NEON, scalar otherwise), chosen once by upper_init().
+// A transform chain ("upper,rot13,checksum") runs registered stages in order,
+// in place on the caller's buffer, without allocating.
+
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*upper_fn_t)(unsigned char *buf, size_t n);
+
+typedef struct {
+  const char *name;
+  upper_fn_t fn;
+  int supported; // non-zero when the running CPU can execute it
+} upper_kernel_t;
+
+// strict_locale != 0 keeps per-byte toupper() so non-ASCII letters follow
+// the process locale (setlocale(LC_CTYPE, "") is done by the caller).
+void upper_init(int strict_locale);
+const char *upper_kernel_name(void);
+
+// All known kernels, for benchmarks and tests; terminated by a NULL name.
+const upper_kernel_t *upper_kernels(void);
+
+extern upper_fn_t g_upper_fn;
+
+static inline void to_uppercase(unsigned char *buf, size_t n) {
+  g_upper_fn(buf, n);
+}
+
+#define MAX_STAGES 8
+
+// Per-message running state, one per stage in a chain.
+typedef struct {
+  uint32_t crc;
+} stage_state_t;
+
+typedef struct {
+  const char *name;
+  // Rewrites n bytes in place; NULL for stages that never touch payload bytes.
+  void (*apply)(unsigned char *buf, size_t n, stage_state_t *st);
+  // Bytes appended at the end of each message, written by finish().
+  size_t trailer_len;
+  void (*finish)(stage_state_t *st, unsigned char *out);
+} transform_stage_t;
+
+typedef struct {
+  const transform_stage_t *stages[MAX_STAGES];
+  int nstages;
+  size_t trailer_len; // total bytes the chain appends per message
+} transform_chain_t;
+
+typedef struct {
+  stage_state_t st[MAX_STAGES];
+} transform_state_t;
+
+// Parses a comma separated list of stage names. Returns 0, or -1 with the
+// offending name copied into bad (if non-NULL).
+int transform_chain_parse(transform_chain_t *chain, const char *spec, char *bad, size_t bad_len);
+void transform_chain_describe(const transform_chain_t *chain, char *out, size_t len);
+// Comma separated names of every registered stage.
+const char *transform_stage_names(void);
+
+// Streaming form: begin once per message, update per chunk, then finish
+// writes chain->trailer_len bytes to out.
+void transform_begin(const transform_chain_t *chain, transform_state_t *ts);
+void transform_update(const transform_chain_t *chain, transform_state_t *ts,
+                      unsigned char *buf, size_t n);
+void transform_finish(const transform_chain_t *chain, transform_state_t *ts, unsigned char *out);
+
+// Whole message in one call. buf must have room for n + chain->trailer_len
+// bytes; returns the new length.
+size_t transform_apply(const transform_chain_t *chain, unsigned char *buf, size_t n);
+
+#endif